@@ -0,0 +1,93 @@
+/* =============================================================================
+   AY register stream player
+
+   Plays music.ays, the per-frame AY registers of music.pt3 rendered by
+   pt3-dump at build time, in place of the PT3 decoder. Uses AYREGS,
+   PT3_state, Player_Pause, Player_Resume and Player_CopyAY from
+   PT3player.c, see pt3-dump.c for the stream tokens.
+============================================================================= */
+
+static const byte *ays_base;
+static const byte *ays_ptr;
+static const byte *ays_ret;
+static byte ays_left;
+static byte ays_wait;
+static byte ays_regs[14];
+
+static void Player_Init(void) {
+    PT3_state = 0;
+    memset(AYREGS, 0, sizeof(AYREGS));
+    AYFULL = 1;
+}
+
+static void Player_Loop(char loop) {
+    if (loop) {
+	PT3_state |= (1 << 4);
+    }
+    else {
+	PT3_state &= ~(1 << 4);
+    }
+}
+
+static void Player_InitSong(word ptr) {
+    ays_base = (const byte *) ptr;
+    ays_ptr = ays_base;
+    ays_left = 0;
+    ays_wait = 0;
+    memset(ays_regs, 0, sizeof(ays_regs));
+    PT3_state = (1 << 1);
+}
+
+static const byte *ays_registers(const byte *src, byte *reg, byte mask) {
+    for (byte i = 0; i < 7; i++) {
+	if (mask & 1) *reg = *src++;
+	mask = mask >> 1;
+	reg++;
+    }
+    return src;
+}
+
+static byte ays_token(void) {
+    for (;;) {
+	byte token = *ays_ptr++;
+	if (token < 0x80) {
+	    byte high = *ays_ptr++;
+	    ays_ptr = ays_registers(ays_ptr, ays_regs, token);
+	    ays_ptr = ays_registers(ays_ptr, ays_regs + 7, high);
+	    return 1;
+	}
+	else if (token > 0xc0) {
+	    ays_wait = token - 0xc1;
+	    return 1;
+	}
+	else if (token == 0xc0) {
+	    if (!(PT3_state & (1 << 4))) return 0;
+	    ays_ptr = ays_base + * (const word *) ays_ptr;
+	}
+	else {
+	    ays_ret = ays_ptr + 2;
+	    ays_left = (token & 0x3f) + 1;
+	    ays_ptr = ays_ret - * (const word *) ays_ptr;
+	}
+    }
+}
+
+static void Player_Decode(void) {
+    if (!(PT3_state & (1 << 1))) return;
+
+    ays_regs[AY_EnvShape] = 0xff;
+    if (ays_wait > 0) {
+	ays_wait--;
+    }
+    else if (!ays_token()) {
+	PT3_state = (PT3_state & ~(1 << 1)) | (1 << 7);
+	ays_regs[AY_AmpA] = 0;
+	ays_regs[AY_AmpB] = 0;
+	ays_regs[AY_AmpC] = 0;
+    }
+
+    if (ays_wait == 0 && ays_left > 0 && --ays_left == 0) {
+	ays_ptr = ays_ret;
+    }
+    memcpy(AYREGS, ays_regs, sizeof(ays_regs));
+}
@@ -99,6 +99,7 @@ mvac7 version:
 #define CHNPRM_Volume 28 //RESB 1
 #define CHNPRM_Size   29 //RESB 1
 
+#ifndef AY_STREAM
 static char ChanA[29];
 static char ChanB[29];
 static char ChanC[29];
@@ -109,10 +110,17 @@ static char CurEDel;
 
 static char Ns_Base;
 static char AddToNs;
+#endif
 
 static char AYREGS[14];
+#ifndef AY_STREAM
 static word EnvBase;
 static char VTABLE[240];
+#endif
+
+static char AYOUT[14];    //registers Player_CopyAY writes to the PSG
+static char AYLAST[13];   //last values written to the PSG (CPC)
+static char AYFULL;       //non zero forces a write of every register
 
 /*
 Switches: 1=ON; 0=OFF
@@ -127,6 +135,7 @@ Switches: 1=ON; 0=OFF
 */
 static char PT3_state;  // before called PT3_SETUP
 
+#ifndef AY_STREAM
 static word PT3_MODADDR;  //direccion datos cancin
 static word PT3_CrPsPtr;  //POSICION CURSOR EN PATTERN
 static word PT3_SAMPTRS;  //sample info?
@@ -192,7 +201,9 @@ static const word NT[96]={
 0x00F,0x00E,0x00D,0x00D,0x00C,0x00B,0x00B,0x00A,0x009,0x009,0x008,0x008,
 };
 #endif
+#endif
 
+#ifndef AY_STREAM
 /* =============================================================================
  Player_Init
  Description: Initialize the Player
@@ -247,11 +258,16 @@ INITV3:
   LD   (HL),A
   LDIR
 
+  INC  A
+  LD   (#_AYFULL),A
+
   pop  IX
   ret
 __endasm;
 }
 
+#endif
+
 /* =============================================================================
  Player_Pause
  Description: Pause song playback
@@ -266,9 +282,9 @@ __asm
 
 MUTE:
   XOR  A
-  LD   (#_AYREGS+AY_AmpA),A
-  LD   (#_AYREGS+AY_AmpB),A
-  LD   (#_AYREGS+AY_AmpC),A
+  LD   (#_AYOUT+AY_AmpA),A
+  LD   (#_AYOUT+AY_AmpB),A
+  LD   (#_AYOUT+AY_AmpC),A
 
   JP   _Player_CopyAY                ;ROUT_A0
   ret
@@ -317,6 +333,7 @@ notFinished:
 __endasm;
 }
 
+#ifndef AY_STREAM
 /* =============================================================================
  Player_Loop
  Description: Change loop state
@@ -1163,6 +1180,8 @@ EMPTYSAMORN:
 __endasm;
 }
 
+#endif
+
 /* -----------------------------------------------------------------------------
  Player_CopyAY
 ----------------------------------------------------------------------------- */
@@ -1174,7 +1193,7 @@ __asm
 	RET  NZ
 
         XOR A
-        LD HL,#_AYREGS
+        LD HL,#_AYOUT
 
 #ifdef ZXS
 	LD DE,#0xFFBF
@@ -1212,7 +1231,36 @@ LOUT:	OUT (C),A
 #endif
 
 #ifdef CPC
+; each PSG write costs six OUTs through the PPI, so registers
+; that did not change since the last call are skipped
+       LD A,(#_AYFULL)
+       AND A
+       JR Z,LSHADOW
+       LD DE,#_AYLAST
+       LD B,#13
+LFORCE:
+       LD A,(HL)
+       CPL
+       LD (DE),A
+       INC HL
+       INC DE
+       DJNZ LFORCE
+       XOR A
+       LD (#_AYFULL),A
+       LD HL,#_AYOUT
+
+LSHADOW:
+       LD DE,#_AYLAST
 LOUT:
+       LD B,A
+       LD A,(DE)
+       CP (HL)
+       LD A,B
+       JR Z,LSAME
+       LD A,(HL)
+       LD (DE),A
+       LD A,B
+
        LD B,#0xF4
        OUT (C),A
        LD BC,#0xF6C0
@@ -1228,7 +1276,9 @@ LOUT:
        LD BC,#0xF600
        OUT (C),C
 
+LSAME:
        INC HL
+       INC DE
        INC A
        CP #13
        JR NZ,LOUT
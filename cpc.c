@@ -2,10 +2,10 @@ static word mul80(word x) {
     return (x << 6) + (x << 4);
 }
 
-static byte cpc_psg(byte reg, byte val) __naked {
+static void cpc_psg(byte reg, byte val) __naked {
     __asm__("di");
     __asm__("ld b, #0xf4");
-    __asm__("ld c, a"); reg;
+    __asm__("ld c, a"); (void) reg;
     __asm__("out (c), c");
     __asm__("ld bc, #0xf6c0");
     __asm__("out (c), c");
@@ -14,7 +14,7 @@ static byte cpc_psg(byte reg, byte val) __naked {
     __asm__("ld bc, #0xf680");
     __asm__("out (c), c");
     __asm__("ld b, #0xf4");
-    __asm__("ld c, l"); val;
+    __asm__("ld c, l"); (void) val;
     __asm__("out (c), c");
     __asm__("ld bc, #0xf600");
     __asm__("out (c), c");
@@ -22,6 +22,7 @@ static byte cpc_psg(byte reg, byte val) __naked {
     __asm__("ret");
 }
 
+#if !defined(HOST)
 static byte cpc_key(byte line) __naked {
     __asm__("ld bc, #0xf782");
     __asm__("out (c), c");
@@ -34,7 +35,7 @@ static byte cpc_key(byte line) __naked {
     __asm__("ld bc, #0xf792");
     __asm__("out (c), c");
     __asm__("ld b, #0xf6");
-    __asm__("or a, #0x40"); line;
+    __asm__("or a, #0x40"); (void) line;
     __asm__("ld c, a");
     __asm__("out (c), c");
     __asm__("ld b, #0xf4");
@@ -45,6 +46,7 @@ static byte cpc_key(byte line) __naked {
     __asm__("out (c), c");
     __asm__("ret");
 }
+#endif
 
 static void setup_system_amstrad_cpc(void) {
     __asm__("ld bc, #0xbc0c");
@@ -71,7 +73,7 @@ static const byte pal1[] = {
 
 static void gate_array(byte reg) {
     __asm__("ld bc, #0x7f00");
-    __asm__("out (c), a"); reg;
+    __asm__("out (c), a"); (void) reg;
 }
 
 static void init_gate_array(const byte *ptr, byte size) {
@@ -82,9 +84,11 @@ static void amstrad_cpc_select_palette(byte num) {
     init_gate_array(num == 0 ? pal0 : pal1, SIZE(pal0));
 }
 
+#if !defined(HOST)
 static void font_rom(void) {
     __asm__(".incbin \"font.rom\"");
 }
+#endif
 
 static void set_border(byte color) {
     gate_array(0x10);
@@ -0,0 +1,710 @@
+/* =============================================================================
+   Headless host build
+
+   Runs main.c natively with -DHOST: the screen, attributes and buffers live
+   in host_ram, the interrupt is replaced by host_tick() called whenever the
+   game idles, port I/O reads as no key pressed and there is no music.
+
+   usage: moonrn-host [-b] [-a] [-f frames] [-j period] [-n run] [-l level]
+		      [-r log] [-p log] [-k ticks] [-q]
+	  moonrn-host -W|-C log...
+	  moonrn-host -t
+	  moonrn-host -i
+
+   -b  bench every level of level_list, a practice run of -f frames each,
+       reporting the wall-clock nanoseconds of this host spent between ticks
+       of that level, the slices run by deferred tasks and the idle spins of
+       wait_vblank, the Z80 cost of a frame is make bench on z80-bench
+   -a  play to survive: in play, fork up to TRIES probes that tap space
+       at random until one lives AHEAD ticks, follow STRIDE ticks of its
+       path and probe again; -j still presses space away from the pond
+   -f  stop after this many frames
+   -j  hold space for 2 frames every period frames, 0 never
+   -n  run number, 0 is the practice run
+   -l  start at this level instead of 1
+   -r  record the run, the level and the space key of every frame to log
+   -p  replay log instead of -j, -n and -l, printing a hash of the screen
+       memory for every frame to stdout
+   -k  fail unless every queued space edge reaches move_player within
+       this many ticks and at least one edge does
+   -q  with -j, tap space instead of holding it: down at the first ZX key
+       poll of the frame, up again by the next tick, so only the polling
+       between interrupts sees it
+   -W  replay every log, one process per core, and write the level and
+       screen hash of every frame to log.base
+   -C  replay every log like -W and compare against log.base, printing
+       the first differing frame and the frames played of every level
+
+   -t  built without BLOCKS, draw every fixed text block of main.c on a
+       blank screen and write its rows to name.blk for pcx-dump -b
+   -i  draw every image of data.h on a blank screen and compare it with
+       the same picture decoded by the decoder of the first release, from
+       the plain copy pcx-dump keeps for HOST; on the ZX a cell may have
+       its pixels and its ink and paper swapped, the colour of every pixel
+       must match
+
+   Built with ZONES=-DZONES it also prints the time spent in every
+   ZONE_BEGIN/ZONE_END pair of main.c, split by enclosing zone.
+============================================================================= */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <time.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+typedef unsigned char byte;
+
+byte host_ram[0x10000] __attribute__((aligned(0x10000)));
+
+void host_start(byte run, byte first);
+byte host_level(void);
+byte host_levels(void);
+unsigned short host_slices(void);
+unsigned short host_idle_spins(void);
+void host_text(byte block);
+byte *host_row(byte y);
+
+struct HostImage {
+    const char *name;
+    const byte *pixel;
+    unsigned short pixel_size;
+    const byte *color;
+    unsigned short color_size;
+    byte w, h;
+};
+byte host_image(byte i, struct HostImage *out);
+int main(int argc, char **argv);
+
+#if defined(ZXS)
+#define SCREEN		0x4000
+#define SCREEN_SIZE	0x1b00
+#define WIDTH		32
+#define CELL		1
+#elif defined(CPC)
+#define SCREEN		0xC000
+#define SCREEN_SIZE	0x4000
+#define WIDTH		64
+#define CELL		2
+#endif
+
+static long frames;
+static long limit = 100000;
+static long period = 24;
+static clock_t start;
+static FILE *record;
+static FILE *replay;
+static byte bench;
+static byte text;
+static byte images;
+static byte first = 1;
+static unsigned *cost;
+static long costs;
+static long mark;
+static FILE *base;
+static byte base_write;
+static long differ = -1;
+static byte differ_level;
+static long level_frames[256];
+static const char *log_name;
+static unsigned short last_slices;
+static unsigned short last_spins;
+static int key_limit = -1;
+static long keys;
+static int key_worst;
+static long slices;
+static long spins;
+static byte held;
+static byte taps;
+static long tapped = -1;
+
+#define AHEAD		160
+#define STRIDE		16
+#define TRIES		200
+
+static byte pilot;
+static byte probing;
+static long probe_end;
+static long moved = -1;
+static byte path[AHEAD];
+static int path_len;
+static byte plan[AHEAD];
+static int plan_len;
+static int plan_at;
+static struct Found {
+    int len;
+    byte path[AHEAD];
+} *found;
+
+static long nanoseconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static int by_cost(const void *a, const void *b) {
+    unsigned x = * (const unsigned *) a;
+    unsigned y = * (const unsigned *) b;
+    return (x > y) - (x < y);
+}
+
+static void bench_report(void) {
+    double sum = 0;
+    if (costs == 0) return;
+    qsort(cost, costs, sizeof(*cost), by_cost);
+    for (long i = 0; i < costs; i++) sum += cost[i];
+    printf("%5d %7ld %7.0f %7u %7u %7ld %7ld\n", first, costs, sum / costs,
+	   cost[costs * 99 / 100], cost[costs - 1], slices, spins);
+}
+
+#if defined(ZONES)
+#define ZONES_MAX	16
+#define ZONE_DEPTH	8
+
+/* same order as the ZONE_ ids in main.c */
+static const char *zone_name[ZONES_MAX] = {
+    "-", "frame", "animate_player", "draw_pond_waves", "draw_player",
+    "draw_twinkle", "move_level", "Player_Decode", "uncompress",
+};
+
+static struct {
+    byte id;
+    long start;
+    long child;
+} zone_stack[ZONE_DEPTH];
+static byte zone_depth;
+static long zone_calls[ZONES_MAX][ZONES_MAX];
+static long zone_total[ZONES_MAX][ZONES_MAX];
+static long zone_self[ZONES_MAX][ZONES_MAX];
+
+void host_zone(byte id) {
+    long now = nanoseconds();
+    if (!(id & 0x80)) {
+	zone_stack[zone_depth].id = id;
+	zone_stack[zone_depth].start = now;
+	zone_stack[zone_depth].child = 0;
+	zone_depth++;
+    }
+    else if (zone_depth > 0) {
+	zone_depth--;
+	byte parent = zone_depth > 0 ? zone_stack[zone_depth - 1].id : 0;
+	long time = now - zone_stack[zone_depth].start;
+	id = zone_stack[zone_depth].id;
+	zone_calls[parent][id]++;
+	zone_total[parent][id] += time;
+	zone_self[parent][id] += time - zone_stack[zone_depth].child;
+	if (zone_depth > 0) zone_stack[zone_depth - 1].child += time;
+    }
+}
+
+static void zone_report(byte parent, int indent) {
+    for (byte id = 1; id < ZONES_MAX; id++) {
+	long calls = zone_calls[parent][id];
+	if (calls == 0) continue;
+	fprintf(stderr, "%*s%-*s %8ld calls %10ld ns %8.0f ns/frame"
+		" %8ld self\n", indent, "", 20 - indent, zone_name[id], calls,
+		zone_total[parent][id], (double) zone_total[parent][id] / frames,
+		zone_self[parent][id]);
+	if (id != parent) zone_report(id, indent + 2);
+    }
+}
+#endif
+
+static void base_report(void) {
+    char *text;
+    size_t size;
+    FILE *out = open_memstream(&text, &size);
+    if (base_write) {
+	fprintf(out, "%s: %ld frames\n", log_name, frames);
+    }
+    else {
+	char more;
+	/* frames left in log.base mean the replay ended early */
+	if (fscanf(base, " %c", &more) == 1 && differ < 0) differ = frames;
+	fprintf(out, "%s: %ld frames, ", log_name, frames);
+	if (differ < 0) {
+	    fprintf(out, "screens match\n");
+	}
+	else {
+	    fprintf(out, "first difference at frame %ld, level %d\n",
+		    differ, differ_level);
+	}
+	fprintf(out, "  level  frames\n");
+	for (int i = 0; i < 256; i++) {
+	    if (level_frames[i] == 0) continue;
+	    fprintf(out, "  %5d %7ld\n", i, level_frames[i]);
+	}
+    }
+    fclose(out);
+    fwrite(text, 1, size, stdout);
+    fclose(base);
+}
+
+void host_key(byte latency) {
+    keys++;
+    if (latency > key_worst) key_worst = latency;
+}
+
+static void key_report(void) {
+    fprintf(stderr, "%ld keys, latency up to %d ticks\n", keys, key_worst);
+    if (keys == 0 || key_worst > key_limit) exit(1);
+}
+
+static void probe_lived(void);
+
+static void host_exit(void) {
+    if (probing) probe_lived();
+    double sec = (double) (clock() - start) / CLOCKS_PER_SEC;
+    if (base) {
+	base_report();
+	exit(differ >= 0);
+    }
+#if defined(ZONES)
+    zone_report(0, 0);
+#endif
+    if (bench) {
+	bench_report();
+    }
+    else {
+	fprintf(stderr, "%ld frames, %.3f s, %.0f frames/s\n",
+		frames, sec, sec > 0 ? frames / sec : 0);
+	fprintf(stderr, "%ld task slices, %ld idle spins\n", slices, spins);
+    }
+    if (record) fclose(record);
+    if (key_limit >= 0) key_report();
+    exit(0);
+}
+
+static unsigned screen_hash(void) {
+    unsigned hash = 2166136261u;
+    for (unsigned i = SCREEN; i < SCREEN + SCREEN_SIZE; i++) {
+	hash = (hash ^ host_ram[i]) * 16777619u;
+    }
+    return hash;
+}
+
+void host_move(void) {
+    moved = frames;
+}
+
+/* the player drowned or was off the bridge when the level ended */
+void host_fail(void) {
+    if (probing) _exit(1);
+}
+
+/* a probe that got this far lived, it hands its path to the parents */
+static void probe_lived(void) {
+    found->len = path_len;
+    memcpy(found->path, path, path_len);
+    _exit(0);
+}
+
+/* forks a child that plays the next probe, -1 in the child, in the
+   parent whether the child lived */
+static int probe(void) {
+    int status;
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) return -1;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/* a probe taps space for 1 to 3 ticks and lets go for 1 to 40 ticks */
+static byte probe_input(void) {
+    static byte down;
+    static int run;
+    if (run-- == 0) {
+	down = !down;
+	run = down ? rand() % 3 : rand() % 40;
+    }
+    return down;
+}
+
+static byte pilot_input(void) {
+    if (plan_at < plan_len) return plan[plan_at++];
+    if (moved != frames) return period > 0 && frames % period < 2;
+    if (probing) return probe_input();
+    /* probes replay less and less of the rest of the last path that
+       lived before they go random */
+    int rest = found->len > STRIDE ? found->len - STRIDE : 0;
+    for (int i = 0; i < TRIES; i++) {
+	int lived = probe();
+	if (lived < 0) {
+	    srand(frames * TRIES + i);
+	    probing = 1;
+	    probe_end = frames + AHEAD;
+	    path_len = 0;
+	    plan_len = rest * (TRIES - 1 - i) / TRIES;
+	    memcpy(plan, found->path + STRIDE, plan_len);
+	    plan_at = 0;
+	    return pilot_input();
+	}
+	if (lived) {
+	    plan_len = found->len < STRIDE ? found->len : STRIDE;
+	    memcpy(plan, found->path, plan_len);
+	    plan_at = 0;
+	    return plan_len > 0 ? plan[plan_at++] : 0;
+	}
+    }
+    /* no probe lived, the player drowns with space up */
+    found->len = 0;
+    return 0;
+}
+
+byte host_input(void) {
+    byte down;
+    if (bench && host_level() == first) {
+	cost[costs++] = nanoseconds() - mark;
+    }
+    if (replay) {
+	int c = fgetc(replay);
+	if (c == EOF) host_exit();
+	down = c;
+    }
+    else if (pilot) {
+	down = pilot_input();
+    }
+    else {
+	down = !taps && period > 0 && frames % period < 2;
+    }
+    if (probing) path[path_len++] = down;
+    if (record) fputc(down, record);
+    held = down;
+    return down;
+}
+
+/* the key between two ticks, the same as at the last one but for taps */
+byte host_poll(void) {
+    if (taps && period > 0 && frames % period == 0 && tapped != frames) {
+	tapped = frames;
+	return 1;
+    }
+    return held;
+}
+
+static void base_frame(void) {
+    unsigned hash = screen_hash();
+    level_frames[host_level()]++;
+    if (base_write) {
+	fprintf(base, "F %ld %d %08x\n", frames, host_level(), hash);
+    }
+    else if (differ < 0) {
+	long frame;
+	unsigned was;
+	if (fscanf(base, " F %ld %*d %x", &frame, &was) != 2 || was != hash) {
+	    differ = frames;
+	    differ_level = host_level();
+	}
+    }
+}
+
+void host_frame(void) {
+    if (base) {
+	base_frame();
+    }
+    else if (replay) {
+	printf("%ld %08x\n", frames, screen_hash());
+    }
+    slices += (unsigned short) (host_slices() - last_slices);
+    spins += (unsigned short) (host_idle_spins() - last_spins);
+    last_slices = host_slices();
+    last_spins = host_idle_spins();
+    if (++frames >= limit) host_exit();
+    if (probing && frames >= probe_end) probe_lived();
+    if (bench) mark = nanoseconds();
+}
+
+static FILE *open_log(const char *name, const char *mode) {
+    FILE *file = fopen(name, mode);
+    if (file == NULL) {
+	fprintf(stderr, "can not open %s\n", name);
+	exit(1);
+    }
+    return file;
+}
+
+static void load_font(const char *name) {
+    FILE *file = open_log(name, "rb");
+    fread(host_ram + 0x3d00, 1, 0x300, file);
+    fclose(file);
+}
+
+static void bench_levels(void) {
+    byte count = host_levels();
+    cost = malloc(limit * sizeof(*cost));
+    printf("level  frames    mean     p99     max  slices   spins\n");
+    for (first = 1; first < count; first++) {
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid == 0) {
+	    start = clock();
+	    mark = nanoseconds();
+	    host_start(0, first);
+	}
+	waitpid(pid, NULL, 0);
+    }
+}
+
+#if !defined(BLOCKS)
+/* x and y in cells, width in bytes, height in cells, then the rows */
+static void save_block(const char *name, int x0, int x1, int y0, int y1) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s.blk", name);
+    FILE *file = open_log(path, "wb");
+    int w = (x1 - x0 + 1) * CELL;
+    fputc(x0, file);
+    fputc(y0, file);
+    fputc(w, file);
+    fputc(y1 - y0 + 1, file);
+    for (int y = y0 * 8; y < (y1 + 1) * 8; y++) {
+	fwrite(host_row(y) + x0 * CELL, 1, w, file);
+    }
+    fclose(file);
+}
+
+static void text_blocks(void) {
+    static const char *name[] = {
+	"intro_block", "p_done_block", "outro_block", "game_over_block",
+    };
+    for (byte i = 0; i < 4; i++) {
+	int x0 = WIDTH, x1 = -1, y0 = 192, y1 = -1;
+	memset(host_ram + SCREEN, 0, SCREEN_SIZE);
+	host_text(i);
+	for (int y = 0; y < 192; y++) {
+	    byte *row = host_row(y);
+	    for (int x = 0; x < WIDTH; x++) {
+		if (row[x] == 0) continue;
+		if (x < x0) x0 = x;
+		if (x > x1) x1 = x;
+		if (y < y0) y0 = y;
+		if (y > y1) y1 = y;
+	    }
+	}
+	save_block(name[i], x0 / CELL, x1 / CELL, y0 / 8, y1 / 8);
+    }
+}
+#endif
+
+/* uncompress() of the first release, the data is one run of memory */
+static void old_uncompress(byte *dst, const byte *src, unsigned short size) {
+    while (size > 0) {
+	byte data = (*src & 0x3f) + 1;
+	switch (*(src++) & 0xc0) {
+	case 0x00:
+	    *(dst++) = data - 1;
+	    break;
+	case 0x40:
+	    memcpy(dst, src, data);
+	    size -= data;
+	    dst += data;
+	    src += data;
+	    break;
+	case 0x80:
+	    memset(dst, *src, data);
+	    dst += data;
+	    size--;
+	    src++;
+	    break;
+	case 0xc0:
+	    memcpy(dst, dst - *src, data);
+	    dst += data;
+	    size--;
+	    src++;
+	    break;
+	}
+	size--;
+    }
+}
+
+#if defined(ZXS)
+/* what a pixel shows: bright and flash, then ink or paper */
+static byte pixel_color(byte data, byte attr, int x) {
+    byte on = (data >> (7 - x)) & 1;
+    return (attr & 0xc0) | (on ? attr & 0x07 : (attr >> 3) & 0x07);
+}
+#endif
+
+static int check_image(const struct HostImage *ref) {
+    static byte pixel[0x4000];
+    int flipped = 0;
+    old_uncompress(pixel, ref->pixel, ref->pixel_size);
+#if defined(ZXS)
+    static byte color[0x300];
+    old_uncompress(color, ref->color, ref->color_size);
+    for (int y = 0; y < ref->h; y++) {
+	for (int x = 0; x < ref->w; x++) {
+	    byte was = color[y * ref->w + x];
+	    byte attr = host_ram[0x5800 + y * 32 + x];
+	    /* a flashing cell swapped would flash the other way round */
+	    if (attr != was && (attr & 0x80)) {
+		printf("%s: cell %d,%d flashes flipped\n", ref->name, x, y);
+		return 1;
+	    }
+	    flipped += attr != was;
+	    for (int r = 0; r < 8; r++) {
+		byte old = pixel[(y * 8 + r) * ref->w + x];
+		byte now = host_row(y * 8 + r)[x];
+		for (int i = 0; i < 8; i++) {
+		    if (pixel_color(old, was, i) != pixel_color(now, attr, i)) {
+			printf("%s: pixel %d,%d is %02x, was %02x\n",
+			       ref->name, x * 8 + i, y * 8 + r,
+			       pixel_color(now, attr, i),
+			       pixel_color(old, was, i));
+			return 1;
+		    }
+		}
+	    }
+	}
+    }
+#elif defined(CPC)
+    for (int y = 0; y < ref->h * 8; y++) {
+	byte *row = host_row(y);
+	for (int x = 0; x < ref->w; x++) {
+	    if (row[x] != pixel[y * ref->w + x]) {
+		printf("%s: byte %d of row %d is %02x, was %02x\n",
+		       ref->name, x, y, row[x], pixel[y * ref->w + x]);
+		return 1;
+	    }
+	}
+    }
+#endif
+    printf("%s: %dx%d cells, %d flipped, screens match\n",
+	   ref->name, ref->w / CELL, ref->h, flipped);
+    return 0;
+}
+
+static int check_images(void) {
+    struct HostImage ref;
+    int failed = 0;
+    for (byte i = 0; host_image(i, &ref); i++) {
+	failed |= check_image(&ref);
+    }
+    return failed;
+}
+
+static void base_run(const char *name) {
+    char path[256];
+    snprintf(path, sizeof(path) - 5, "%s", name);
+    char *dot = strrchr(path, '.');
+    strcpy(dot ? dot : path + strlen(path), ".base");
+    log_name = name;
+    replay = open_log(name, "rb");
+    base = open_log(path, base_write ? "w" : "r");
+    byte run = fgetc(replay);
+    first = fgetc(replay);
+    limit = LONG_MAX;
+    host_start(run, first);
+}
+
+static int base_logs(char **logs, int count) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int running = 0;
+    int failed = 0;
+    int status;
+    fflush(stdout);
+    for (int i = 0; i < count; i++) {
+	if (running == cpus) {
+	    wait(&status);
+	    failed |= status != 0;
+	    running--;
+	}
+	if (fork() == 0) base_run(logs[i]);
+	running++;
+    }
+    while (running-- > 0) {
+	wait(&status);
+	failed |= status != 0;
+    }
+    return failed;
+}
+
+int main(int argc, char **argv) {
+    byte run = 0;
+    byte all = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "abf:j:n:l:r:p:k:qWCti")) != -1) {
+	switch (opt) {
+	case 'W':
+	    base_write = 1;
+	    all = 1;
+	    break;
+	case 'C':
+	    all = 1;
+	    break;
+	case 'b':
+	    bench = 1;
+	    break;
+	case 't':
+	    text = 1;
+	    break;
+	case 'i':
+	    images = 1;
+	    break;
+	case 'f':
+	    limit = atol(optarg);
+	    break;
+	case 'j':
+	    period = atol(optarg);
+	    break;
+	case 'n':
+	    run = atoi(optarg);
+	    break;
+	case 'l':
+	    first = atoi(optarg);
+	    break;
+	case 'r':
+	    record = open_log(optarg, "wb");
+	    break;
+	case 'p':
+	    replay = open_log(optarg, "rb");
+	    break;
+	case 'k':
+	    key_limit = atoi(optarg);
+	    break;
+	case 'q':
+	    taps = 1;
+	    break;
+	case 'a':
+	    pilot = 1;
+	    break;
+	default:
+	    return 1;
+	}
+    }
+    if (replay) {
+	run = fgetc(replay);
+	first = fgetc(replay);
+    }
+    if (record) {
+	fputc(run, record);
+	fputc(first, record);
+    }
+    load_font("font.rom");
+    if (pilot) {
+	found = mmap(NULL, sizeof(*found), PROT_READ | PROT_WRITE,
+		     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    }
+    if (all) {
+	return base_logs(argv + optind, argc - optind);
+    }
+    if (bench) {
+	bench_levels();
+	return 0;
+    }
+    if (images) {
+	return check_images();
+    }
+#if !defined(BLOCKS)
+    if (text) {
+	text_blocks();
+	return 0;
+    }
+#endif
+    start = clock();
+    host_start(run, first);
+    return 0;
+}
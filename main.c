@@ -1,4 +1,9 @@
+#if defined(HOST)
+#define __naked
+#define __asm__(...)
+#else
 #define AY
+#endif
 
 void start_up(void) __naked {
     __asm__("di");
@@ -22,9 +27,17 @@ struct Image {
     const byte *color;
     word color_size;
 #endif
+    byte mode;
     byte w, h;
 };
 
+/* Image.mode as written by pcx-dump, the low bits hold the line filter */
+#define FILTER_XOR	1
+#define FILTER_DELTA	2
+#define FILTER_MASK	3
+#define MODE_NATIVE	4
+#define MODE_TILES	8
+
 struct Level {
     const byte *level;
     const char *msg;
@@ -39,47 +52,104 @@ struct Twinkle {
 };
 
 #include "data.h"
+#if defined(BLOCKS)
+#include "blocks.h"
+#endif
 
 #define NULL		((void *) 0)
+#if defined(HOST)
+extern byte host_ram[];
+#define ADDR(obj)	((word) (unsigned long) (obj))
+#define MEM(addr)	(host_ram + (word) (addr))
+#else
 #define ADDR(obj)	((word) (obj))
-#define BYTE(addr)	(* (volatile byte *) (addr))
-#define WORD(addr)	(* (volatile word *) (addr))
+#define MEM(addr)	((byte *) (addr))
+#endif
+#define BYTE(addr)	(* (volatile byte *) MEM(addr))
+#define WORD(addr)	(* (volatile word *) MEM(addr))
 #define SIZE(array)	(sizeof(array) / sizeof(*(array)))
 
 static volatile byte vblank;
 static volatile byte space_up;
 static volatile byte ticker;
 static volatile byte use_joy;
-static byte *map_y[192];
 static void *tmp;
 
 void reset(void);
 
+#define SPACE_DOWN()	KEY_DOWN(space_up)
+
 #if defined(ZXS)
-#define SPACE_DOWN()	!space_up
+#define KEY_UP		0x01
+#define KEY_DOWN(up)	!(up)
 #define SETUP_STACK()	__asm__("ld sp, #0xfdfc")
-#define FONT_PTR	((byte *) 0x3c00)
+#define FONT_PTR	MEM(0x3c00)
 #define IRQ_BASE	0xfe00
 #define TEMP_BUF	0x5b00
+#define GLYPH_BUF	0xf400
+#define GLYPH_SLOTS	128
+#define GLYPH_SPREAD	4
+#define ROW_LO		0x8000
+#define ROW_HI		0x8100
 #define WIDTH		0x20
 #define PLAYER		8
 #define BPP_SHIFT	0
+#define SFX_PERIOD(p)	(((p) << 1) + (p))
 #endif
 
 #if defined(CPC)
-#define SPACE_DOWN()	(space_up != 0x90)
+#define KEY_UP		0x90
+#define KEY_DOWN(up)	((up) != KEY_UP)
 #define SETUP_STACK()	__asm__("ld sp, #0x95fc")
 #define FONT_PTR	(((byte *) &font_rom) - 0x100)
 #define IRQ_BASE	0x9600
 #define TEMP_BUF	0xa000
+#define GLYPH_BUF	0x9800
+#define GLYPH_SLOTS	64
+#define GLYPH_SPREAD	4
+#define ROW_LO		0x8B00
+#define ROW_HI		0x8C00
 #define WIDTH		0x40
 #define PLAYER		16
 #define BPP_SHIFT	1
+#define SFX_PERIOD(p)	((p) << 1)
+#endif
+
+#if defined(HOST)
+#undef FONT_PTR
+#define FONT_PTR	MEM(0x3c00)
+#endif
+
+#define SPRITE_PTRS	(8 * sizeof(byte *))
+
+/* screen row addresses are split into two page aligned tables */
+#define ROW(y)		MEM(MEM(ROW_LO)[y] | (MEM(ROW_HI)[y] << 8))
+#define ROWS(y, h)	((y) > 192 - (h) ? 192 - (y) : (h))
+
+/* contact() of a sinking player reads up to BELOW rows past row 191,
+   those map to blank bytes past the row tables instead of whatever
+   followed map_y */
+#define BELOW		3
+#define BELOW_ROW	(ROW_LO + 0xe0)
+
+#if defined(ZXS)
+#define NEXT_ROW(ptr) do { \
+    ptr = MEM(ADDR(ptr) + 0x100); \
+    if ((ADDR(ptr) & 0x700) == 0) ptr = next_cell(ptr); \
+} while (0)
+#elif defined(CPC)
+#define NEXT_ROW(ptr) do { \
+    ptr = MEM(ADDR(ptr) + 0x800); \
+    if (ADDR(ptr) < 0x800) ptr = MEM(ADDR(ptr) + 0xC050); \
+} while (0)
 #endif
+#define LEVEL_ADDR(ptr)	MEM(* (const word *) (ptr))
 
+#if !defined(HOST)
 static void __sdcc_call_hl(void) __naked {
     __asm__("jp (hl)");
 }
+#endif
 
 static void memset(byte *ptr, byte data, word len) {
     while (len-- > 0) { *ptr++ = data; }
@@ -89,36 +159,14 @@ static void memcpy(byte *dst, const byte *src, word len) {
     while (len-- > 0) { *dst++ = *src++; }
 }
 
+static void key_edge(void);
+
 static void interrupt(void) __naked {
     __asm__("di");
     __asm__("push af");
     __asm__("push bc");
     __asm__("push hl");
 
-#if defined(CPC)
-    __asm__("ld b, #0xf5");
-    __asm__("in a, (c)");
-    __asm__("and a, #1");
-    __asm__("jp z, skip_handler");
-#endif
-
-#if defined(AY)
-    __asm__("ld a, (_enable_AY)");
-    __asm__("and a");
-    __asm__("jp z, skip_AY");
-
-    __asm__("push de");
-    __asm__("push ix");
-    __asm__("push iy");
-    __asm__("call _Player_Decode");
-    __asm__("call _Player_CopyAY");
-    __asm__("pop iy");
-    __asm__("pop ix");
-    __asm__("pop de");
-
-    __asm__("skip_AY:");
-#endif
-
 #if defined(ZXS)
     __asm__("ld a, #0x7f");
     __asm__("in a, (#0xfe)");
@@ -140,7 +188,6 @@ static void interrupt(void) __naked {
     __asm__("dont_use_joy:");
 
     __asm__("ld a, l");
-    __asm__("ld (_space_up), a");
 #endif
 
 #if defined(CPC)
@@ -153,8 +200,45 @@ static void interrupt(void) __naked {
     __asm__("call _cpc_key");
     __asm__("and #0x10");
     __asm__("or l");
+#endif
+
+    __asm__("ld hl, #_space_up");
+    __asm__("cp (hl)");
+    __asm__("jr z, same_key");
+    __asm__("ld (hl), a");
+    __asm__("push de");
+    __asm__("push iy");
+    __asm__("call _key_edge");
+    __asm__("pop iy");
+    __asm__("pop de");
+    __asm__("same_key:");
+
+#if defined(CPC)
+    __asm__("ld b, #0xf5");
+    __asm__("in a, (c)");
+    __asm__("and a, #1");
+    __asm__("jp z, skip_handler");
+#endif
+
+#if defined(AY)
+    __asm__("ld a, (_enable_AY)");
+    __asm__("ld hl, #_sfx_frames");
+    __asm__("or (hl)");
+    __asm__("jp z, skip_AY");
+
+    __asm__("push de");
+    __asm__("push ix");
+    __asm__("push iy");
+    __asm__("ld a, (_enable_AY)");
+    __asm__("and a");
+    __asm__("call nz, _music_frame");
+    __asm__("call _sfx_mix");
+    __asm__("call _Player_CopyAY");
+    __asm__("pop iy");
+    __asm__("pop ix");
+    __asm__("pop de");
 
-    __asm__("ld (_space_up), a");
+    __asm__("skip_AY:");
 #endif
 
     __asm__("ld a, #1");
@@ -172,20 +256,178 @@ static void interrupt(void) __naked {
     __asm__("reti");
 }
 
+/* every change of space_up seen by the interrupt is queued with its tick */
+#define KEY_EVENTS	8
+
+static byte key_tick[KEY_EVENTS];
+static byte key_level[KEY_EVENTS];
+static volatile byte key_head;
+static byte key_tail;
+static byte key_latency;
+
+static void key_edge(void) {
+    byte i = key_head & (KEY_EVENTS - 1);
+    if ((byte) (key_head - key_tail) < KEY_EVENTS) {
+	key_tick[i] = ticker;
+	key_level[i] = space_up;
+	key_head++;
+    }
+}
+
+#if defined(HOST)
+void host_key(byte latency);
+void host_move(void);
+void host_fail(void);
+#endif
+
+static byte next_key(void) {
+    byte i = key_tail & (KEY_EVENTS - 1);
+    key_latency = ticker - key_tick[i];
+#if defined(HOST)
+    host_key(key_latency);
+#endif
+    key_tail++;
+    return KEY_DOWN(key_level[i]);
+}
+
+static void flush_keys(void) {
+    key_tail = key_head;
+}
+
+/* space is down or went down since the queue was read, even if let go */
+static byte space_pressed(void) {
+    byte down = SPACE_DOWN();
+    while (key_tail != key_head) down |= next_key();
+    return down;
+}
+
+#if defined(HOST)
+/* host build: the tick stands in for the interrupt when the game idles */
+byte host_input(void);
+byte host_poll(void);
+void host_frame(void);
+
+static byte host_first;
+
+static void host_tick(void) {
+    byte level = host_input() ? 0 : KEY_UP;
+    if (level != space_up) {
+	space_up = level;
+	key_edge();
+    }
+    vblank = 1;
+    ticker++;
+    host_frame();
+}
+
+#define HOST_IDLE()	host_tick()
+#else
+#define HOST_IDLE()
+#endif
+
 static void setup_irq(byte base) {
     __asm__("di");
-    __asm__("ld i, a"); base;
+    __asm__("ld i, a"); (void) base;
     __asm__("im 2");
     __asm__("ei");
 }
 
+#if defined(ZXS)
 static void out_fe(byte data) {
-    __asm__("out (#0xfe), a"); data;
+    __asm__("out (#0xfe), a"); (void) data;
+}
+#endif
+
+/* -DZONES writes zone marks to port 0xff, which no hardware decodes */
+#define ZONE_FRAME	1
+#define ZONE_ANIMATE	2
+#define ZONE_WAVES	3
+#define ZONE_PLAYER	4
+#define ZONE_TWINKLE	5
+#define ZONE_SCROLL	6
+#define ZONE_MUSIC	7
+#define ZONE_UNCOMPRESS	8
+
+#if defined(ZONES)
+#if defined(HOST)
+void host_zone(byte id);
+#endif
+
+static void zone(byte id) {
+#if defined(HOST)
+    host_zone(id);
+#elif defined(ZXS)
+    __asm__("out (#0xff), a"); (void) id;
+#elif defined(CPC)
+    __asm__("ld b, #0xff");
+    __asm__("out (c), a"); (void) id;
+#endif
+}
+
+#define ZONE_BEGIN(id)	zone(id)
+#define ZONE_END(id)	zone((id) | 0x80)
+#else
+#define ZONE_BEGIN(id)
+#define ZONE_END(id)
+#endif
+
+#if defined(AY)
+static void music_ahead(void);
+#else
+#define music_ahead()
+#endif
+
+#if defined(ZXS)
+static void poll_key(void);
+#else
+#define poll_key()
+#endif
+
+/* deferred work runs in fixed size slices while waiting for vblank, it is
+   the sprites shifted for the end of a run, a frame draws in its own time */
+struct Task {
+    byte (*slice)(void);
+    word slices;
+};
+
+#define MAX_TASKS	4
+
+static struct Task *task_queue[MAX_TASKS];
+static byte task_count;
+static word idle_spins;
+
+static void add_task(struct Task *task) {
+    task->slices = 0;
+    task_queue[task_count++] = task;
+}
+
+static byte run_task(void) {
+    if (task_count == 0) return 0;
+    struct Task *task = task_queue[0];
+    task->slices++;
+    if (!task->slice()) {
+	task_count--;
+	for (byte i = 0; i < task_count; i++) {
+	    task_queue[i] = task_queue[i + 1];
+	}
+    }
+    return 1;
+}
+
+static void finish_tasks(void) {
+    while (run_task()) { }
 }
 
 static void wait_vblank(void) {
     vblank = 0;
-    while (!vblank) { }
+    while (!vblank) {
+	music_ahead();
+	poll_key();
+	if (!run_task()) {
+	    idle_spins++;
+	    HOST_IDLE();
+	}
+    }
 }
 
 static void delay(byte n) {
@@ -199,28 +441,103 @@ static void delay(byte n) {
 #if defined(AY)
 static byte enable_AY;
 #include "PT3player.c"
+#if defined(AY_STREAM)
+#include "AYstream.c"
+#endif
+
+/* music is decoded ahead in idle time, the interrupt only copies frames */
+#define AY_AHEAD	4
+#define AY_SLOT(i)	ay_ring[(i) & (AY_AHEAD - 1)]
+
+static byte ay_ring[AY_AHEAD][14];
+static volatile byte ay_head;
+static volatile byte ay_tail;
+
+static void music_ahead(void) {
+    if (enable_AY && (byte) (ay_head - ay_tail) < AY_AHEAD) {
+	ZONE_BEGIN(ZONE_MUSIC);
+	Player_Decode();
+	ZONE_END(ZONE_MUSIC);
+	memcpy(AY_SLOT(ay_head), AYREGS, sizeof(AYREGS));
+	ay_head++;
+    }
+}
+
+/* a frame the main loop did not decode in time repeats the last one */
+static void music_frame(void) {
+    if (ay_head != ay_tail) {
+	memcpy(AYOUT, AY_SLOT(ay_tail), sizeof(AYOUT));
+	ay_tail++;
+    }
+    else {
+	memcpy(AYOUT, AY_SLOT(ay_tail - 1), sizeof(AYOUT));
+	AYOUT[AY_EnvShape] = 0xff;
+    }
+}
 
 static void start_music(void) {
+    ay_tail = ay_head;
+    memset(AY_SLOT(ay_tail - 1), 0, sizeof(AYOUT));
     Player_Resume();
     enable_AY = 1;
 }
 
 static void stop_music(void) {
     enable_AY = 0;
+    ay_tail = ay_head;
+    __asm__("di");
     Player_Pause();
+    __asm__("ei");
 }
 
-static void silence_music(void) {
-    PT3_state |= (1 << 2);
+/* sound effects borrow channel A of AYOUT before Player_CopyAY */
+static byte sfx_prio;
+static byte sfx_volume;
+static word sfx_period;
+static volatile byte sfx_frames;
+
+static void sfx_mix(void) {
+    if (sfx_frames > 0) {
+	sfx_frames--;
+	AYOUT[AY_ToneA + 0] = sfx_period & 0xff;
+	AYOUT[AY_ToneA + 1] = sfx_period >> 8;
+	AYOUT[AY_Mixer] = (AYOUT[AY_Mixer] & ~0x01) | 0x08;
+	AYOUT[AY_AmpA] = sfx_frames > 0 ? sfx_volume : 0;
+	if (sfx_volume > 0) sfx_volume--;
+	if (sfx_frames == 0) sfx_prio = 0;
+    }
 }
 
-static void resume_music(void) {
-    __asm__("di");
-    memset(AYREGS, 0, 14);
-    PT3_state &= ~(1 << 2);
-    __asm__("ei");
+static void play_sfx(word period, byte prio) {
+    if (prio >= sfx_prio) {
+	__asm__("di");
+	sfx_prio = prio;
+	sfx_volume = 0x0f;
+	sfx_period = SFX_PERIOD(period);
+	sfx_frames = 3;
+	__asm__("ei");
+    }
+}
+
+#if defined(ZXS)
+/* register 0 of an AY reads back what was written, a 48K has no AY */
+static byte ay_read_back(byte value) __naked {
+    __asm__("ld bc, #0xfffd");
+    __asm__("ld e, a"); (void) value;
+    __asm__("xor a");
+    __asm__("out (c), a");
+    __asm__("ld b, #0xbf");
+    __asm__("out (c), e");
+    __asm__("ld b, #0xff");
+    __asm__("in a, (c)");
+    __asm__("ret");
 }
 
+static byte ay_found(void) {
+    return ay_read_back(0x5a) == 0x5a && ay_read_back(0xa5) == 0xa5;
+}
+#endif
+
 static void select_music(void *ptr) {
     static void *current;
     if (enable_AY) {
@@ -240,105 +557,171 @@ static void select_music(void *ptr) {
 }
 
 static void music_tune(void) {
+#if defined(AY_STREAM)
+    __asm__(".incbin \"music.ays\"");
+#else
     __asm__(".incbin \"music.pt3\"");
+#endif
 }
 #else
 
 #define select_music(x)
-#define silence_music()
-#define resume_music()
 #define stop_music()
+#define ay_found()	0
+
+#endif
 
+#if defined(ZXS)
+/* the beeper only sounds effects when there is no AY to play them */
+static byte speaker;
 #endif
 
 static void setup_system(void) {
 #if defined(AY)
     enable_AY = 0;
+    sfx_frames = 0;
+    sfx_prio = 0;
+    memset(AYOUT, 0, sizeof(AYOUT));
+    AYFULL = 1;
+    ay_head = 0;
+    ay_tail = 0;
 #endif
 
     byte top = (byte) ((IRQ_BASE >> 8) - 1);
     word jmp_addr = (top << 8) | top;
     BYTE(jmp_addr + 0) = 0xc3;
     WORD(jmp_addr + 1) = ADDR(&interrupt);
-    memset((byte *) IRQ_BASE, top, 0x101);
+    memset(MEM(IRQ_BASE), top, 0x101);
     setup_irq(IRQ_BASE >> 8);
 
-#if defined(CPC)
+#if defined(ZXS)
+    speaker = ay_found() ? 0x00 : 0x10;
+#elif defined(CPC)
     setup_system_amstrad_cpc();
 #endif
 }
 
+#if defined(ZXS)
+/* NEXT_ROW crossed a character row, step back into the right third */
+static byte *next_cell(byte *ptr) {
+    word addr = ADDR(ptr);
+    addr = (addr & 0xff00) | (byte) (addr + 0x20);
+    if (addr & 0xe0) addr -= 0x800;
+    return MEM(addr);
+}
+#endif
+
+static void set_row(byte y, word addr) {
+    MEM(ROW_LO)[y] = addr & 0xff;
+    MEM(ROW_HI)[y] = addr >> 8;
+}
+
 static void precalculate(void) {
+#if defined(LEAN)
     for (byte y = 0; y < 192; y++) {
 #if defined(ZXS)
 	byte f = ((y & 7) << 3) | ((y >> 3) & 7) | (y & 0xc0);
-	map_y[y] = (byte *) (0x4000 + (f << 5));
+	set_row(y, 0x4000 + (f << 5));
 #elif defined(CPC)
 	word f = ((y & 7) << 11) | mul80(y >> 3);
-	map_y[y] = (byte *) (0xC000 + f);
+	set_row(y, 0xC000 + f);
 #endif
     }
+#else
+    /* row_table is made by pcx-dump -t, low bytes then high bytes */
+    memcpy(MEM(ROW_LO), row_table, 192);
+    memcpy(MEM(ROW_HI), row_table + 192, 192);
+#endif
+    /* contact() looks a few rows below the screen when the player sinks */
+    memset(MEM(BELOW_ROW), 0, 0x20);
+    for (byte y = 192; y < 192 + BELOW; y++) set_row(y, BELOW_ROW);
 }
 
 static void clear_screen(void) {
 #if defined(ZXS)
-    memset((byte *) 0x5800, 0x00, 0x300);
-    memset((byte *) 0x4000, 0x00, 0x1800);
+    memset(MEM(0x5800), 0x00, 0x300);
+    memset(MEM(0x4000), 0x00, 0x1800);
     out_fe(0);
 #elif defined(CPC)
-    memset((byte *) 0xC000, 0x00, 0x4000);
+    memset(MEM(0xC000), 0x00, 0x4000);
     amstrad_cpc_select_palette(0);
 #endif
 }
 
-static void put_char(char symbol, byte x, byte y) {
-    byte shift = x & (7 >> BPP_SHIFT);
-    byte offset = x >> (3 - BPP_SHIFT);
-    byte *addr = FONT_PTR + (symbol << 3);
-    for (byte i = 0; i < 8; i++) {
-	byte data = *addr++;
-	byte *ptr = map_y[y + i] + offset;
+/*
+ * cache of shifted glyphs, the shifts of a symbol are spread apart in the
+ * slots so the symbol alone tells which shift a slot holds, 0 is empty;
+ * on ZX it sits between the code and the stack, out of contended RAM, on
+ * CPC in the page after the IM2 table, which ends at IRQ_BASE + 0x100
+ */
+#define GLYPH_BYTES	(2 + BPP_SHIFT)
+#define GLYPH_TAG	MEM(GLYPH_BUF)
+#define GLYPH_DATA	MEM(GLYPH_BUF + GLYPH_SLOTS)
+
+static void reset_glyphs(void) {
+    memset(GLYPH_TAG, 0, GLYPH_SLOTS);
+}
+
+static const byte *glyph(char symbol, byte shift) {
+    byte slot = (symbol + (shift << GLYPH_SPREAD)) & (GLYPH_SLOTS - 1);
+    byte *buf = GLYPH_DATA + slot * (8 * GLYPH_BYTES);
+    if (GLYPH_TAG[slot] != symbol) {
+	const byte *addr = FONT_PTR + (symbol << 3);
+	byte *dst = buf;
+	GLYPH_TAG[slot] = symbol;
+	for (byte i = 0; i < 8; i++) {
+	    byte data = *addr++;
 #if defined(ZXS)
-	ptr[0] |= (data >> shift);
-	ptr[1] |= (data << (8 - shift));
+	    *dst++ = data >> shift;
+	    *dst++ = data << (8 - shift);
 #elif defined(CPC)
-	byte value = data >> shift;
-	ptr[0] |= value >> 4;
-	ptr[1] |= value & 0xf;
-	ptr[2] |= (data << (4 - shift)) & 0xf;
+	    byte value = data >> shift;
+	    *dst++ = value >> 4;
+	    *dst++ = value & 0xf;
+	    *dst++ = (data << (4 - shift)) & 0xf;
 #endif
+	}
     }
+    return buf;
 }
 
-static byte char_mask(char symbol) {
-    byte mask = 0;
-    byte *addr = FONT_PTR + (symbol << 3);
-    for (byte i = 0; i < 8; i++) {
-	mask |= *addr++;
-    }
-    return mask;
-}
+#if defined(ZXS)
+#define GLYPH_ROW() do { \
+    ptr[0] |= src[0]; \
+    ptr[1] |= src[1]; \
+    src += GLYPH_BYTES; \
+    NEXT_ROW(ptr); \
+} while (0)
+#elif defined(CPC)
+#define GLYPH_ROW() do { \
+    ptr[0] |= src[0]; \
+    ptr[1] |= src[1]; \
+    ptr[2] |= src[2]; \
+    src += GLYPH_BYTES; \
+    NEXT_ROW(ptr); \
+} while (0)
+#endif
 
+static void put_char(char symbol, byte x, byte y) {
+    const byte *src = glyph(symbol, x & (7 >> BPP_SHIFT));
+    byte *ptr = ROW(y) + (x >> (3 - BPP_SHIFT));
+    GLYPH_ROW();
+    GLYPH_ROW();
+    GLYPH_ROW();
+    GLYPH_ROW();
+    GLYPH_ROW();
+    GLYPH_ROW();
+    GLYPH_ROW();
+    GLYPH_ROW();
+}
+
+/* font_metrics is made by pcx-dump -f, leading + 1 and trailing nibbles */
 static byte leading(char symbol) {
-    byte i;
-    byte mask = char_mask(symbol);
-    for (i = 0; i < 8; i++) {
-	if (mask & 0x80) goto done;
-	mask = mask << 1;
-    }
-  done:
-    return i - 1;
+    return (font_metrics[symbol - ' '] >> 4) - 1;
 }
 
 static byte trailing(char symbol) {
-    byte i;
-    byte mask = char_mask(symbol);
-    for (i = 0; i < 8; i++) {
-	if (mask & 1) goto done;
-	mask = mask >> 1;
-    }
-  done:
-    return 8 - i;
+    return font_metrics[symbol - ' '] & 0xf;
 }
 
 static void put_str(const char *msg, byte x, byte y) {
@@ -356,19 +739,6 @@ static void put_str(const char *msg, byte x, byte y) {
     }
 }
 
-static char to_hex(byte digit) {
-    return (digit < 10) ? '0' + digit : 'A' + digit - 10;
-}
-
-static void put_num(word num, byte x, byte y) {
-    char msg[] = "0000";
-    for (byte i = 0; i < 4; i++) {
-	msg[3 - i] = to_hex(num & 0xf);
-	num = num >> 4;
-    }
-    put_str(msg, x, y);
-}
-
 static byte str_len(const char *msg) {
     byte len = 0;
     while (*msg != 0) {
@@ -382,6 +752,7 @@ static byte str_offset(const char *msg, byte from) {
     return from - (str_len(msg) >> 1);
 }
 
+#if !defined(BLOCKS)
 static byte text_gap(const char * const *str_list) {
     byte offset = 128;
     while (*str_list) {
@@ -404,91 +775,251 @@ static byte text_top(const char * const *str_list, byte window) {
     }
     return (window - height) >> 1;
 }
+#endif
+
+/* images are decoded straight into screen rows, stream_row(r) is row r */
+static byte stream_x;
+static byte stream_y;
+static byte stream_w;
+#if defined(ZXS)
+static byte stream_color;
+#endif
 
-static void uncompress(byte *dst, const byte *src, word size) {
+static byte *stream_row(byte r) {
+#if defined(ZXS)
+    if (stream_color) return MEM(0x5800 + ((stream_y + r) << 5) + stream_x);
+#endif
+    return ROW((stream_y << 3) + r) + stream_x;
+}
+
+/* back references may reach a few rows up, runs are split at row ends */
+static void uncompress(const byte *src, word size, byte rows) {
+    ZONE_BEGIN(ZONE_UNCOMPRESS);
+    byte row = 0;
+    byte col = 0;
+    byte *dst = stream_row(0);
     while (size > 0) {
+	byte type = *src & 0xc0;
+	byte data = (*(src++) & 0x3f) + 1;
+	byte value = data - 1;
+	const byte *from = src;
+	switch (type) {
+	case 0x00:
+	    data = 1;
+	    break;
+	case 0x40:
+	    size -= data;
+	    src += data;
+	    break;
+	default:
+	    value = *(src++);
+	    size--;
+	    break;
+	}
+	while (data > 0) {
+	    byte n = stream_w - col;
+	    if (n > data) n = data;
+	    if (type == 0x40) {
+		memcpy(dst, from, n);
+		from += n;
+	    }
+	    else if (type == 0xc0) {
+		byte back = row;
+		word back_col = col;
+		while (back_col < value) {
+		    back_col += stream_w;
+		    back--;
+		}
+		back_col -= value;
+		if (n > stream_w - back_col) n = stream_w - back_col;
+		memcpy(dst, stream_row(back) + back_col, n);
+	    }
+	    else {
+		memset(dst, value, n);
+	    }
+	    dst += n;
+	    col += n;
+	    data -= n;
+	    if (col == stream_w) {
+		if (++row == rows) goto done;
+		dst = stream_row(row);
+		col = 0;
+	    }
+	}
+	size--;
+    }
+  done:
+    ZONE_END(ZONE_UNCOMPRESS);
+}
+
+/* decode len bytes to one run of memory, returns where the input ended */
+static const byte *unpack(byte *dst, const byte *src, word len) {
+    ZONE_BEGIN(ZONE_UNCOMPRESS);
+    while (len > 0) {
 	byte data = (*src & 0x3f) + 1;
 	switch (*(src++) & 0xc0) {
 	case 0x00:
 	    *(dst++) = data - 1;
+	    data = 1;
 	    break;
 	case 0x40:
 	    memcpy(dst, src, data);
-	    size -= data;
 	    dst += data;
 	    src += data;
 	    break;
 	case 0x80:
-	    memset(dst, *src, data);
+	    memset(dst, *(src++), data);
 	    dst += data;
-	    size--;
-	    src++;
 	    break;
 	case 0xc0:
-	    memcpy(dst, dst - *src, data);
+	    memcpy(dst, dst - *(src++), data);
 	    dst += data;
-	    size--;
-	    src++;
 	    break;
 	}
-	size--;
+	len -= data;
     }
+    ZONE_END(ZONE_UNCOMPRESS);
+    return src;
 }
 
-static void display_part_image(struct Image *img, byte x, byte y, byte n) {
-    byte *ptr = tmp;
-    x = x << BPP_SHIFT;
-    uncompress(ptr, img->pixel, img->pixel_size);
+/* pcx-dump stores pixel lines as the xor or difference to the line above */
+/* back references read filtered lines, so this is a pass after decoding */
+static void unfilter(const struct Image *img, byte x, byte y, byte n) {
+    byte w = img->w;
+    byte *up = ROW(y << 3) + x;
+    for (byte r = 1; r < n << 3; r++) {
+	byte *dst = ROW((y << 3) + r) + x;
+	if ((img->mode & FILTER_MASK) == FILTER_XOR) {
+	    for (byte i = 0; i < w; i++) dst[i] ^= up[i];
+	}
+	else {
+	    for (byte i = 0; i < w; i++) dst[i] += up[i];
+	}
+	up = dst;
+    }
+}
 
-    byte bottom = (y + n) << 3;
-    for (byte i = y << 3; i < bottom; i++) {
-	memcpy(map_y[i] + x, ptr, img->w);
-	ptr += img->w;
+#if defined(CPC)
+/* a full width image made by pcx-dump -n, one block per line of the cells */
+static void display_native(const struct Image *img, byte y) {
+    const byte *src = img->pixel;
+    byte *dst = ROW(y << 3);
+    for (byte i = 0; i < 8; i++) {
+	src = unpack(dst, src, mul80(img->h) - 16);
+	dst += 0x800;
     }
+    if (img->mode & FILTER_MASK) unfilter(img, 0, y, img->h);
+}
+#endif
 
+/*
+ * an image made by pcx-dump -d, its pixels start with the cell count;
+ * cells are drawn in map order from anywhere in the set, so map and set
+ * are unpacked to TEMP_BUF first, pcx-dump -d fails when they outgrow it
+ * (1305 bytes at most, the CPC title) and prints what they take
+ */
+static void display_tiles(const struct Image *img, byte x, byte y) {
+    byte cols = img->w >> BPP_SHIFT;
+    word cells = cols * img->h;
+    byte *map = MEM(TEMP_BUF);
+    byte *set = map + cells;
+    const byte *src = img->pixel;
+    byte tiles = *(src++);
+    src = unpack(map, src, cells);
+    unpack(set, src, tiles << (3 + BPP_SHIFT));
+
+    for (byte r = 0; r < img->h; r++) {
+	byte *row = ROW((y + r) << 3) + (x << BPP_SHIFT);
+	for (byte c = 0; c < cols; c++) {
+	    src = set + (*(map++) << (3 + BPP_SHIFT));
+	    byte *dst = row;
+	    for (byte i = 0; i < 8; i++) {
 #if defined(ZXS)
-    uncompress(ptr, img->color, img->color_size);
-    byte *addr = (byte *) 0x5800 + (y << 5) + x;
-    for (byte i = 0; i < n; i++) {
-	memcpy(addr, ptr, img->w);
-	ptr += img->w;
-	addr += 0x20;
+		*dst = *(src++);
+		dst += 0x100;
+#elif defined(CPC)
+		dst[0] = *(src++);
+		dst[1] = *(src++);
+		dst += 0x800;
+#endif
+	    }
+	    row += 1 << BPP_SHIFT;
+	}
     }
+
+#if defined(ZXS)
+    stream_x = x;
+    stream_y = y;
+    stream_w = img->w;
+    stream_color = 1;
+    uncompress(img->color, img->color_size, img->h);
 #endif
 }
 
-static void display_image(struct Image *img, byte x, byte y) {
-    display_part_image(img, x, y, img->h);
+static void display_part_image(const struct Image *img, byte x, byte y, byte n) {
+    stream_x = x << BPP_SHIFT;
+    stream_y = y;
+    stream_w = img->w;
+#if defined(ZXS)
+    stream_color = 0;
+#endif
+    uncompress(img->pixel, img->pixel_size, n << 3);
+    if (img->mode & FILTER_MASK) unfilter(img, stream_x, y, n);
+
+#if defined(ZXS)
+    if (img->color == NULL) return;
+    stream_color = 1;
+    uncompress(img->color, img->color_size, n);
+#endif
+}
+
+static void display_image(const struct Image *img, byte x, byte y) {
+#if defined(CPC)
+    if (img->mode & MODE_NATIVE) {
+	display_native(img, y);
+	return;
+    }
+#endif
+    if (img->mode & MODE_TILES) {
+	display_tiles(img, x, y);
+    }
+    else {
+	display_part_image(img, x, y, img->h);
+    }
 }
 
 #define PiB (8 >> BPP_SHIFT) /* pixels in byte */
-static byte *generate_sprite(const byte *src, byte *dst, byte w, byte h) {
+static byte *generate_shift(const byte *from, byte *buf, byte i, byte w, byte h) {
 #if defined(CPC)
     static const byte mask1[] = { 0xff, 0x77, 0x33, 0x11 };
     static const byte mask2[] = { 0xff, 0xee, 0xcc, 0x88, 0x00 };
 #endif
-    byte **ptr = dst;
-    byte *buf = dst + 16;
-    w = w << BPP_SHIFT;
-    for (byte i = 0; i < PiB; i++) {
-	ptr[i] = buf;
-	const byte *from = src;
-	for (byte y = 0; y < h; y++) {
-	    memset(buf, 0, w + 1);
-	    for (byte x = 0; x < w; x++) {
-		byte j = (PiB - i);
-		byte data = *from++;
+    for (byte y = 0; y < h; y++) {
+	memset(buf, 0, w + 1);
+	for (byte x = 0; x < w; x++) {
+	    byte j = (PiB - i);
+	    byte data = *from++;
 #if defined(ZXS)
-		buf[0] |= data >> i;
-		buf[1] |= data << j;
+	    buf[0] |= data >> i;
+	    buf[1] |= data << j;
 #elif defined(CPC)
-		buf[0] |= (data >> i) & mask1[i];
-		buf[1] |= (data << j) & mask2[j];
+	    buf[0] |= (data >> i) & mask1[i];
+	    buf[1] |= (data << j) & mask2[j];
 #endif
-		buf++;
-	    }
 	    buf++;
 	}
+	buf++;
+    }
+    return buf;
+}
+
+static byte *generate_sprite(const byte *src, byte *dst, byte w, byte h) {
+    byte **ptr = (byte **) dst;
+    byte *buf = dst + SPRITE_PTRS;
+    w = w << BPP_SHIFT;
+    for (byte i = 0; i < PiB; i++) {
+	ptr[i] = buf;
+	buf = generate_shift(src, buf, i, w, h);
     }
     return buf;
 }
@@ -497,15 +1028,17 @@ static void put_sprite(byte *addr, byte x, byte y, byte w, byte h) {
     addr = ((byte **) addr)[x & (7 >> BPP_SHIFT)];
     x = x >> (3 - BPP_SHIFT);
     w = (w << BPP_SHIFT) + 1;
-    byte top = y + h;
-    for (; y < top; y++) {
-	byte *ptr = map_y[y] + x;
+    byte *row = ROW(y) + x;
+    for (; h > 0; h--) {
+	byte *ptr = row;
 	for (byte i = 0; i < w; i++) {
 	    *ptr++ ^= *addr++;
 	}
+	NEXT_ROW(row);
     }
 }
 
+#if !defined(BLOCKS)
 static const char * const intro[] = {
     "  Each year in the Mondlauf Kingdom, the last",
     "full moon casts its rays on royal ponds making",
@@ -517,6 +1050,7 @@ static const char * const intro[] = {
     "and a jug of the finest moonshine as a reward.",
     NULL,
 };
+#endif
 
 static void lit_line(byte offset, byte color) {
 #if defined(ZXS)
@@ -529,12 +1063,16 @@ static void lit_line(byte offset, byte color) {
 	offset++;
     }
 #elif defined(CPC)
-    offset; color;
+    (void) offset; (void) color;
 #endif
 }
 
 static byte rlc(byte a) {
+#if defined(HOST)
+    a = (a << 1) | (a >> 7);
+#else
     __asm__("rlc a");
+#endif
 #if defined(CPC)
     if (a & 0x10) a = (a | 0x01) & 0x0f;
 #endif
@@ -542,7 +1080,9 @@ static byte rlc(byte a) {
 }
 
 static byte rrc(byte a) {
-#if defined(ZXS)
+#if defined(ZXS) && defined(HOST)
+    return (a >> 1) | (a << 7);
+#elif defined(ZXS)
     __asm__("rrc a");
     return a;
 #elif defined(CPC)
@@ -552,7 +1092,7 @@ static byte rrc(byte a) {
 }
 
 static void shift_water_row(byte y) {
-    byte *addr = map_y[y];
+    byte *addr = ROW(y);
     for (int8 i = 0; i < 32 << BPP_SHIFT; i++) {
 	byte value = *addr;
 	*addr++ = rlc(value);
@@ -620,25 +1160,26 @@ static const char* start_string(void) {
 
 static void print_start_message(void) {
     for (byte y = 168; y < 168 + 8; y++) {
-	memset(map_y[y] + (4 << BPP_SHIFT), 0, 24 << BPP_SHIFT);
+	memset(ROW(y) + (4 << BPP_SHIFT), 0, 24 << BPP_SHIFT);
     }
     center_msg(concat("Press SPACE to ", start_string()), 168);
 }
 
 static void put_bitmap(const byte *addr, byte x, word y, byte c) {
-    byte h = y << 3;
     x = x << BPP_SHIFT;
-    for (byte i = h; i < h + 8; i++) {
-	byte *ptr = map_y[i] + x;
+    byte *row = ROW(y << 3) + x;
+    for (byte i = 0; i < 8; i++) {
+	byte *ptr = row;
 #if defined(CPC)
 	*ptr++ = *addr++;
 #endif
 	*ptr = *addr++;
+	NEXT_ROW(row);
     }
 #if defined(ZXS)
     BYTE(0x5800 + (y << 5) + x) = c;
 #else
-    c;
+    (void) c;
 #endif
 }
 
@@ -652,9 +1193,27 @@ static void show_joystick(void) {
 
 #if defined(ZXS)
 static byte in_joy(byte a) {
-    __asm__("in a, (#0x1f)"); a;
+    __asm__("in a, (#0x1f)"); (void) a;
     return a;
 }
+
+/* the interrupt samples space 50 times a second, idle loops poll it in
+   between so that a tap shorter than a frame is still queued (CPC samples
+   it on all six interrupts of a frame) */
+static void poll_key(void) {
+#if defined(HOST)
+    byte level = host_poll() ? 0 : KEY_UP;
+#else
+    byte level = in_key(0x7f) & 1;
+    if (use_joy) level &= (byte) ~in_joy(0) >> 4;
+#endif
+    __asm__("di");
+    if (level != space_up) {
+	space_up = level;
+	key_edge();
+    }
+    __asm__("ei");
+}
 #endif
 
 static void select_joystick(void) {
@@ -681,7 +1240,7 @@ static void show_select_menu(void) {
 	    display_part_image(&select, x, 23, 1);
 	}
 	if (i == run_num) {
-	    byte *addr = map_y[191] + (x << BPP_SHIFT);
+	    byte *addr = ROW(191) + (x << BPP_SHIFT);
 	    memcpy(select_clear, addr, sizeof(select_clear));
 	    put_char('_', (x << 3) + 3, 184);
 	}
@@ -694,13 +1253,15 @@ static void select_run(byte on) {
 	put_char('_', (x << 3) + 3, 184);
     }
     else {
-	byte *addr = map_y[191] + (x << BPP_SHIFT);
+	byte *addr = ROW(191) + (x << BPP_SHIFT);
 	memcpy(addr, select_clear, sizeof(select_clear));
     }
 }
 
 static byte in_key(byte a) {
-#if defined(ZXS)
+#if defined(HOST)
+    a = 0xff;
+#elif defined(ZXS)
     __asm__("in a, (#0xfe)");
 #elif defined(CPC)
     __asm__("di");
@@ -735,6 +1296,10 @@ static void select_menu_item(void) {
 }
 
 static void show_intro_text(void) {
+#if defined(BLOCKS)
+    /* text blocks are drawn by moonrn-host -t at build time */
+    display_image(&intro_block, INTRO_BLOCK_X, INTRO_BLOCK_Y);
+#else
     const char * const *str_list = intro;
     byte x = text_gap(intro);
     byte y = 50 + text_top(intro, 108);
@@ -743,6 +1308,7 @@ static void show_intro_text(void) {
 	put_str(*str_list, x, y);
 	str_list++;
     }
+#endif
 }
 
 static void show_title(void) {
@@ -756,7 +1322,7 @@ static void show_title(void) {
     show_joystick();
 
     byte roll = 0;
-    while (!SPACE_DOWN()) {
+    while (!space_pressed()) {
 	wait_vblank();
 	animate_water();
 	lit_line(roll - 32, 0x41);
@@ -824,7 +1390,7 @@ static const struct Twinkle twinkle_map[] = {
     { levelS, 132, 80  },
     { levelL, 264, 154 },
     { levelC, 356, 152 },
-    { NULL, NULL },
+    { NULL, 0, 0 },
 };
 
 static void reset_variables(void) {
@@ -836,42 +1402,54 @@ static void reset_variables(void) {
 
 static void init_variables(void) {
     lives = 6;
+#if defined(HOST)
+    level = host_first;
+#else
     level = 1;
-    space_up = 0;
+#endif
+    space_up = KEY_UP;
     frame = runner;
     reset_variables();
-    tmp = (void *) TEMP_BUF;
+    key_head = 0;
+    key_tail = 0;
+    tmp = MEM(TEMP_BUF);
+    task_count = 0;
 }
 
 static void clear_player(void) {
-    byte y = pos;
+    byte n = ROWS(pos, 8);
     const byte *ptr = frame;
-    for (byte i = 0; i < 8; i++) {
-	byte *addr = map_y[y++] + PLAYER;
+    byte *row = ROW(pos) + PLAYER;
+    for (byte i = 0; i < n; i++) {
+	byte *addr = row;
 #if defined(CPC)
 	*addr++ ^= *ptr++;
 #endif
 	*addr ^= *ptr++;
+	NEXT_ROW(row);
     }
 }
 
 static void erase_player(byte x, byte y) {
-    x = x << BPP_SHIFT;
-    for (byte i = 0; i < 8; i++) {
-	byte *addr = map_y[y++] + x;
+    byte n = ROWS(y, 8);
+    byte *row = ROW(y) + (x << BPP_SHIFT);
+    for (byte i = 0; i < n; i++) {
+	byte *addr = row;
 #if defined(CPC)
 	*addr++ = 0;
 #endif
 	*addr = 0;
+	NEXT_ROW(row);
     }
 }
 
 static byte draw_player(void) {
-    byte y = pos;
+    byte n = ROWS(pos, 8);
     const byte *ptr = frame;
-    for (byte i = 0; i < 8; i++) {
+    byte *row = ROW(pos) + PLAYER;
+    for (byte i = 0; i < n; i++) {
 	byte data = *ptr++;
-	byte *addr = map_y[y++] + PLAYER;
+	byte *addr = row;
 #if defined(CPC)
 	if (*addr & data) return 1;
 	*addr++ |= data;
@@ -879,12 +1457,13 @@ static byte draw_player(void) {
 #endif
 	if (*addr & data) return 1;
 	*addr |= data;
+	NEXT_ROW(row);
     }
     return 0;
 }
 
 static byte contact(void) {
-    byte *addr = map_y[pos + 8] + PLAYER;
+    byte *addr = ROW(pos + 8) + PLAYER;
 
 #if defined (ZXS)
     return *addr;
@@ -906,6 +1485,7 @@ static void double_jump(byte space) {
 static void move_player(void) {
     byte space = SPACE_DOWN();
     if (vel >= 0 && contact()) {
+	while (key_tail != key_head) space |= next_key();
 	vel = space ? VELOCITY : 0;
 	jump = 0;
     }
@@ -914,6 +1494,7 @@ static void move_player(void) {
 	if (vel < -VELOCITY) {
 	    vel = vel + 1;
 	}
+	while (key_tail != key_head) double_jump(next_key());
 	double_jump(space);
 	new = pos + (vel >> 2);
 	if (vel > 0) {
@@ -941,6 +1522,9 @@ static byte on_bridge(void) {
 
 static void animate_player(void) {
     move_player();
+#if defined(HOST)
+    host_move();
+#endif
     if (!contact()) {
 	frame = runner + (jump == 2 ? 0 : (48 << BPP_SHIFT));
     }
@@ -958,11 +1542,12 @@ static void draw_pond_waves(void) {
     while (*addr) **addr++ = *data++;
 }
 
+#if defined(ZXS)
 static void shade_cone(byte *ptr, byte color, byte width, byte step) {
     for (byte y = 8; y < 24; y++) {
 	memset(ptr, color, width);
 	if ((y & step) == step) {
-	    if (((byte) ptr & 0x1f) > 0) {
+	    if (((byte) ADDR(ptr) & 0x1f) > 0) {
 		width++;
 		ptr--;
 	    }
@@ -971,17 +1556,18 @@ static void shade_cone(byte *ptr, byte color, byte width, byte step) {
 	ptr += 32;
     }
 }
+#endif
 
 static const byte bridge[] = { 0xff, 0x44, 0x22 };
 
 static void setup_moon_shade(void) {
 #if defined(ZXS)
-    memset((void *) 0x5900, 1, 0x200);
-    shade_cone((byte *) 0x5902, 5, 14, 0);
-    shade_cone((byte *) 0x5903, 7, 12, 1);
-    memset((void *) 0x5a80, 5, 0x18);
-    memset((void *) 0x5aa0, 5, 0x18);
-    memset((void *) 0x5ac0, 1, 0x40);
+    memset(MEM(0x5900), 1, 0x200);
+    shade_cone(MEM(0x5902), 5, 14, 0);
+    shade_cone(MEM(0x5903), 7, 12, 1);
+    memset(MEM(0x5a80), 5, 0x18);
+    memset(MEM(0x5aa0), 5, 0x18);
+    memset(MEM(0x5ac0), 1, 0x40);
 #elif defined(CPC)
     amstrad_cpc_select_palette(1);
 #endif
@@ -989,7 +1575,7 @@ static void setup_moon_shade(void) {
 
 static void draw_bridge(void) {
     for (byte i = 0; i <= 2; i++) {
-	byte *addr = map_y[BRIDGE_TOP + i];
+	byte *addr = ROW(BRIDGE_TOP + i);
 	memset(addr, bridge[i], BRIDGE_LEN >> 3);
     }
 }
@@ -1002,10 +1588,15 @@ static void clear_twinkle(void) {
     }
 }
 
-static void sound_fx(word period, byte border);
+#define SFX_FADE	1
+#define SFX_DROWN	2
+#define SFX_LIVES	3
+#define SFX_TWINKLE	4
+
+static void sound_fx(word period, byte border, byte prio);
 
 static void twinkle_sound(void) {
-    for (word p = 150; p > 50; p -= 20) sound_fx(p, 0);
+    for (word p = 150; p > 50; p -= 20) sound_fx(p, 0, SFX_TWINKLE);
 }
 
 #if defined(ZXS)
@@ -1040,7 +1631,7 @@ static void draw_twinkle(void) {
     };
 #endif
     if (*twinkle_ptr) {
-	word pos = twinkle_offset - scroll >> BPP_SHIFT;
+	word pos = (twinkle_offset - scroll) >> BPP_SHIFT;
 	byte offset = (pos >> (3 - BPP_SHIFT)) & level_mask;
 	if (offset < WIDTH)  {
 	    byte index = (ticker & 4) == 0;
@@ -1064,7 +1655,8 @@ static void animate_wave(void) {
 }
 
 static void wave_before_start(void) {
-    while (on_bridge() && !SPACE_DOWN()) {
+    flush_keys();
+    while (on_bridge() && !space_pressed()) {
 	animate_wave();
 	draw_player();
 	draw_twinkle();
@@ -1074,51 +1666,60 @@ static void wave_before_start(void) {
     }
 }
 
+#if defined(ZXS)
 static void vblank_delay(word ticks) {
     for (word i = 0; i < ticks; i++) { if (vblank) break; }
 }
 
-static void sound_fx(word period, byte border) {
+/* the beeper only sounds while the CPU toggles it, for the whole frame */
+static void beeper_fx(word period, byte border) {
     vblank = 0;
-
-#if defined(CPC)
-    silence_music();
-    cpc_psg(0x7, 0x3E);
-    cpc_psg(0x8, 0x0F);
-    period = period << 1;
-    cpc_psg(0, period & 0xff);
-    cpc_psg(1, period >> 8);
-#endif
-
     while (!vblank) {
-#if defined(ZXS)
-	out_fe(border | 0x10);
+	out_fe(border | speaker);
 	vblank_delay(period);
 	out_fe(0x0);
 	vblank_delay(period);
-#elif defined(CPC)
-	set_border(border);
-	vblank_delay(period);
-	set_border(0x54);
-	vblank_delay(period);
-#endif
+	HOST_IDLE();
     }
+}
+#endif
 
-#if defined(CPC)
-    cpc_psg(0x7, 0x3F);
-    resume_music();
+/* one step of an effect, sfx_mix plays it on the AY while the frame idles */
+static void sound_fx(word period, byte border, byte prio) {
+#if defined(ZXS)
+    if (speaker) {
+	beeper_fx(period, border);
+	return;
+    }
+#endif
+#if defined(AY)
+    play_sfx(period, prio);
+#else
+    (void) period; (void) prio;
+#endif
+#if defined(ZXS)
+    out_fe(border);
+    wait_vblank();
+    out_fe(0x0);
+#elif defined(CPC)
+    set_border(border);
+    wait_vblank();
+    set_border(0x54);
 #endif
 }
 
 static void drown_player(void) {
     word period = 20;
+#if defined(HOST)
+    host_fail();
+#endif
     frame = drowner;
     erase_player(8, pos);
     while (frame < drowner + sizeof(drowner)) {
 	clear_twinkle();
 	draw_twinkle();
 	draw_player();
-	sound_fx(period, 0);
+	sound_fx(period, 0, SFX_DROWN);
 	clear_player();
 	period += 10;
 	if ((ticker & 3) == 0) {
@@ -1140,7 +1741,7 @@ static void fade_sound(byte ticks) {
 #elif defined(CPC)
 	    static const byte border[] = { 0x52, 0x5D, 0x4B };
 #endif
-	    sound_fx(fade_period >> i, border[i]);
+	    sound_fx(fade_period >> i, border[i], SFX_FADE);
 	}
 	fade_period -= 50;
     }
@@ -1162,7 +1763,7 @@ static void prepare_level(byte data) {
 	offset = offset & level_mask;
 	if (offset < WIDTH) {
 	    byte length = ptr[3];
-	    byte *addr = * (byte **) ptr + offset;
+	    byte *addr = LEVEL_ADDR(ptr) + offset;
 	    if (offset + length >= WIDTH) {
 		length = WIDTH - offset;
 	    }
@@ -1204,7 +1805,10 @@ static const byte *level_ptr;
     *current_addr++ = addr; \
     *current_data++ = data; }
 
+#if defined(CPC)
 static byte two_byte;
+#endif
+
 static void scroller(byte count, byte offset, byte data) {
 #if defined(CPC)
     if (two_byte) offset++;
@@ -1215,7 +1819,7 @@ static void scroller(byte count, byte offset, byte data) {
 	distance = (distance - 1) & level_mask;
 
 	if (distance < WIDTH) {
-	    byte *addr = * (byte **) level_ptr;
+	    byte *addr = LEVEL_ADDR(level_ptr);
 	    addr = addr + distance;
 	    UPDATE_WAVE(addr, data);
 #if defined(CPC)
@@ -1266,7 +1870,7 @@ static void draw_and_clear_bridge(void) {
     if (scroll >= start) {
 	byte data = scroll_data(7);
 	for (byte i = 0; i <= 2; i++) {
-	    byte *addr = map_y[BRIDGE_TOP + i] + WIDTH - 1;
+	    byte *addr = ROW(BRIDGE_TOP + i) + WIDTH - 1;
 	    UPDATE_WAVE(addr - offset, data & bridge[i]);
 	}
     }
@@ -1275,7 +1879,7 @@ static void draw_and_clear_bridge(void) {
 	byte data = scroll_data(6);
 	byte from = (scroll < BRIDGE_LEN ? 8 << BPP_SHIFT : 40 << BPP_SHIFT);
 	for (byte i = BRIDGE_TOP; i <= BRIDGE_TOP + 2; i++) {
-	    byte *addr = map_y[i] + from - offset + BPP_SHIFT;
+	    byte *addr = ROW(i) + from - offset + BPP_SHIFT;
 	    UPDATE_WAVE(addr, data & *addr);
 	}
     }
@@ -1305,7 +1909,7 @@ static byte level_done(void) {
 static void level_message(const char *msg) {
     byte top = bonus_run() ? 24 : 32;
     for (byte y = top; y < top + 8; y++) {
-	memset(map_y[y] + (0x13 << BPP_SHIFT), 0, 10 << BPP_SHIFT);
+	memset(ROW(y) + (0x13 << BPP_SHIFT), 0, 10 << BPP_SHIFT);
     }
     put_str(msg, 152 + str_offset(msg, 40), top);
 }
@@ -1313,7 +1917,7 @@ static void level_message(const char *msg) {
 static void twinkle_init_ptr(byte y) {
     twinkle_height = y;
     for (byte i = 0; i < 2; i++) {
-	twinkle_ptr[i] = map_y[y + i];
+	twinkle_ptr[i] = ROW(y + i);
     }
 }
 
@@ -1333,7 +1937,7 @@ static void search_twinkle_map(const struct Level *ptr) {
 }
 
 static void select_twinkle(const struct Level *ptr) {
-    memset(twinkle_ptr, 0, sizeof(twinkle_ptr));
+    memset((byte *) twinkle_ptr, 0, sizeof(twinkle_ptr));
     if (bonus_run()) search_twinkle_map(ptr);
 }
 
@@ -1347,11 +1951,23 @@ static void select_level(byte i) {
     select_twinkle(ptr);
 }
 
-static void end_game(const char *msg, byte y) {
+static void end_screen(void) {
     clear_screen();
-    center_msg(msg, y);
 #if defined(ZXS)
-    memset((void *) 0x5900, 0x41, 0x200);
+    memset(MEM(0x5900), 0x41, 0x200);
+#endif
+}
+
+static void end_game(const char *msg, byte y) {
+    end_screen();
+    center_msg(msg, y);
+}
+
+static void game_over_text(void) {
+#if defined(BLOCKS)
+    display_image(&game_over_block, GAME_OVER_BLOCK_X, GAME_OVER_BLOCK_Y);
+#else
+    center_msg("GAME OVER", 92);
 #endif
 }
 
@@ -1383,15 +1999,11 @@ static const char *last_str(void) {
     return concat(years(), " years. A big celebration is in order.");
 }
 
-static const char *get_str(const char *ptr) {
-    return ptr == (void *) &last_str ? last_str() : ptr;
-}
-
+#if !defined(BLOCKS)
 static const char * const outro[] = {
     " As you skip over the last patch of moonlight,",
     "the crowd cheers especially loud. After all,",
     "no one has completed this challenge in the past",
-    (void *) &last_str,
     NULL,
 };
 
@@ -1402,16 +2014,28 @@ static const char * const p_done[] = {
     NULL,
 };
 
-static void show_outro_text(void) {
-    byte y = 88;
-    const char * const *text;
-    text = practice_run() ? p_done : outro;
+static void put_lines(const char * const *text, byte y) {
     while (*text) {
-	put_str(get_str(*text), 4, y);
+	put_str(*text, 4, y);
 	y = y + 8;
 	text++;
     }
 }
+#endif
+
+static void show_outro_text(void) {
+#if defined(BLOCKS)
+    if (practice_run()) {
+	display_image(&p_done_block, P_DONE_BLOCK_X, P_DONE_BLOCK_Y);
+    }
+    else {
+	display_image(&outro_block, OUTRO_BLOCK_X, OUTRO_BLOCK_Y);
+    }
+#else
+    put_lines(practice_run() ? p_done : outro, 88);
+#endif
+    if (!practice_run()) put_str(last_str(), 4, 112);
+}
 
 static const char *done_message(void) {
     switch (run_num) {
@@ -1451,7 +2075,8 @@ static void game_done(void) {
     }
     display_image(&title, 0, 1);
 
-    while (!SPACE_DOWN()) {
+    flush_keys();
+    while (!space_pressed()) {
 	wait_vblank();
 	animate_water();
     }
@@ -1461,9 +2086,9 @@ static void game_done(void) {
 
 static void outro_dimming(void) {
 #if defined(ZXS)
-    byte *ptr = (byte *) 0x5920 - 3;
-    memset((byte *) 0x5a20, 7, 64);
-    memset((byte *) 0x5a60, 1, 32);
+    byte *ptr = MEM(0x5920) - 3;
+    memset(MEM(0x5a20), 7, 64);
+    memset(MEM(0x5a60), 1, 32);
     for (byte y = 8; y < 24; y++) {
 	memset(ptr, 0, 3);
 	ptr += 0x20;
@@ -1478,7 +2103,6 @@ static void draw_boat(byte *buf, byte x) {
 
 #define SPLASH_WIDTH ((3 << BPP_SHIFT) + 1)
 static void splashing(byte *buf, byte dir, byte rev) {
-    byte y = 64;
     for (byte i = 0; i < (8 >> BPP_SHIFT); i++) {
 	byte *addr = ((byte **) buf)[i];
 	addr = addr + sizeof(boat) + 8 - SPLASH_WIDTH;
@@ -1540,14 +2164,52 @@ static void boat_leaves(byte *buf) {
 }
 
 static byte *free;
-static byte *generate_one(const byte *src, byte w, byte h) {
-    byte *ptr = free;
-    free = generate_sprite(src, ptr, w, h);
-    return ptr;
+static byte *jumper_sprite;
+static byte *boat_sprite;
+
+struct Sprite {
+    const byte *src;
+    byte **slot;
+    byte w, h;
+};
+
+static const struct Sprite finish_sprites[] = {
+    { runner + (48 << BPP_SHIFT), &jumper_sprite, 1, 8 },
+    { boat, &boat_sprite, 3, 8 },
+    { waver, wave_sprite + 0, 1, 8 },
+    { waver + PLAYER, wave_sprite + 1, 1, 8 },
+    { NULL, NULL, 0, 0 },
+};
+
+/* one slice generates one pre-shifted copy of one sprite */
+static const struct Sprite *sprite_job;
+static byte sprite_shift;
+static byte *sprite_buf;
+
+static byte sprite_slice(void) {
+    const struct Sprite *job = sprite_job;
+    byte **ptr = (byte **) free;
+    if (sprite_shift == 0) sprite_buf = free + SPRITE_PTRS;
+    ptr[sprite_shift] = sprite_buf;
+    sprite_buf = generate_shift(job->src, sprite_buf, sprite_shift,
+				job->w << BPP_SHIFT, job->h);
+    if (++sprite_shift == PiB) {
+	*job->slot = free;
+	free = sprite_buf;
+	sprite_shift = 0;
+	sprite_job++;
+    }
+    return sprite_job->src != NULL;
 }
 
-static byte *generate_jumper(void) {
-    return generate_one(runner + (48 << BPP_SHIFT), 1, 8);
+static struct Task sprite_task;
+
+static void generate_finish_sprites(void) {
+    free = tmp;
+    sprite_job = finish_sprites;
+    sprite_shift = 0;
+    sprite_task.slice = &sprite_slice;
+    add_task(&sprite_task);
 }
 
 static void jump_in_boat(byte *buf) {
@@ -1569,15 +2231,11 @@ static void jump_in_boat(byte *buf) {
 }
 
 static void animate_finish(void) {
-    free = tmp;
-    byte *jumper = generate_jumper();
-    byte *laiva = generate_one(boat, 3, 8);
-    wave_sprite[0] = generate_one(waver, 1, 8);
-    wave_sprite[1] = generate_one(waver + PLAYER, 1, 8);
+    finish_tasks();
     outro_dimming();
-    boat_arrives(laiva);
-    jump_in_boat(jumper);
-    boat_leaves(laiva);
+    boat_arrives(boat_sprite);
+    jump_in_boat(jumper_sprite);
+    boat_leaves(boat_sprite);
 }
 
 static byte flip_bits(byte source) {
@@ -1608,26 +2266,40 @@ static void draw_away_runner(byte *buf, byte x) {
     put_sprite(buf, x, 128, 1, 8);
 }
 
-static void generate_runner(byte **frm) {
-    flip_runner(tmp);
-    byte *ptr = tmp;
-    byte *buf = tmp;
-    buf += sizeof(runner);
-    for (byte i = 0; i < 8; i++) {
-	frm[i] = buf;
-	buf = generate_sprite(ptr, buf, 1, 8);
-	ptr += PLAYER;
+/* the first slice flips the runner, each one after shifts one frame */
+static byte *runner_frm[8];
+static byte runner_job;
+static byte *runner_buf;
+
+static byte runner_slice(void) {
+    byte i = runner_job;
+    if (i == 0) {
+	flip_runner(tmp);
+	runner_buf = (byte *) tmp + sizeof(runner);
     }
+    else {
+	runner_frm[i - 1] = runner_buf;
+	runner_buf = generate_sprite((byte *) tmp + (i - 1) * PLAYER,
+				     runner_buf, 1, 8);
+    }
+    return ++runner_job <= 8;
+}
+
+static struct Task runner_task;
+
+static void generate_runner(void) {
+    runner_job = 0;
+    runner_task.slice = &runner_slice;
+    add_task(&runner_task);
 }
 
 static void player_run_away(void) {
     byte x = 64;
-    byte *frm[8];
-    generate_runner(frm);
+    finish_tasks();
     wait_vblank();
     clear_player();
     while (x > 0) {
-	byte *ptr = frm[(ticker & 0xe) >> 1];
+	byte *ptr = runner_frm[(ticker & 0xe) >> 1];
 	draw_away_runner(ptr, x);
 	wait_vblank();
 	draw_away_runner(ptr, x);
@@ -1659,7 +2331,7 @@ static void fade_empty_level(void) {
 
 static void count_twinkles(void) {
     twinkle_num = 0;
-    byte *addr = map_y[36] + (21 << BPP_SHIFT);
+    byte *addr = ROW(36) + (21 << BPP_SHIFT);
     for (byte i = 0; i < 6; i++) {
 	twinkle_num = twinkle_num << 1;
 	if ((*addr & 0xf0) == 0x70) {
@@ -1671,11 +2343,17 @@ static void count_twinkles(void) {
 
 static void change_level(void) {
     level++;
-    if (level < SIZE(level_list)) {
+    if ((byte) level < SIZE(level_list)) {
 	select_level(level);
     }
     else {
 	stop_music();
+	if (practice_run()) {
+	    generate_runner();
+	}
+	else {
+	    generate_finish_sprites();
+	}
 	fade_empty_level();
 	animate_victory();
 	count_twinkles();
@@ -1710,6 +2388,9 @@ static byte next_level(void) {
 	advance_level();
     }
     else if (done) {
+#if defined(HOST)
+	host_fail();
+#endif
 	scroll = 0;
     }
     return next;
@@ -1731,18 +2412,32 @@ static void game_loop(void) {
     draw_player();
     wait_vblank();
     space_up = 0;
+    flush_keys();
 
     while (!drown && pos < 184) {
-	/* draw */
+	ZONE_BEGIN(ZONE_FRAME);
+
+	/* draw, waves may land on the player so it is cleared before them */
 	clear_twinkle();
 	clear_player();
+	ZONE_BEGIN(ZONE_ANIMATE);
 	animate_player();
+	ZONE_END(ZONE_ANIMATE);
+	ZONE_BEGIN(ZONE_WAVES);
 	draw_pond_waves();
+	ZONE_END(ZONE_WAVES);
+	ZONE_BEGIN(ZONE_PLAYER);
 	drown = draw_player();
+	ZONE_END(ZONE_PLAYER);
+	ZONE_BEGIN(ZONE_TWINKLE);
 	draw_twinkle();
+	ZONE_END(ZONE_TWINKLE);
 
 	/* calculate */
+	ZONE_BEGIN(ZONE_SCROLL);
 	move_level();
+	ZONE_END(ZONE_SCROLL);
+	ZONE_END(ZONE_FRAME);
 	if (next_level()) {
 	    goto restart;
 	}
@@ -1764,21 +2459,26 @@ static void put_fatal_level_name(void) {
 }
 
 static void game_over(void) {
-    end_game("GAME OVER", 92);
+    end_screen();
+    game_over_text();
     put_fatal_level_name();
-    while (!SPACE_DOWN()) { }
+    flush_keys();
+    while (!space_pressed()) {
+	poll_key();
+	HOST_IDLE();
+    }
     reset();
 }
 
 static void lose_cleanup(void) {
-    byte *addr = map_y[63];
+    byte *addr = ROW(63);
 #if defined(ZXS)
     addr[8] = addr[9];
 #elif defined(CPC)
     memcpy(addr + 16, addr + 18, 2);
 #endif
     for (byte y = 64; y < 192; y++) {
-	memset(map_y[y], 0, WIDTH);
+	memset(ROW(y), 0, WIDTH);
     }
     if (lives >= 0 && !practice_run()) {
 	erase_player(21 + lives, 44);
@@ -1790,7 +2490,7 @@ static void no_lives(void) {
     for (byte x = 0; x < 6; x++) {
 	erase_player(26 - x, 44);
 	if (bonus_run()) put_bitmap(bonus, 21 + x, 4, 6);
-	sound_fx((x + 8) << 4, 0);
+	sound_fx((x + 8) << 4, 0, SFX_LIVES);
 	delay(3);
     }
 }
@@ -1818,6 +2518,7 @@ void reset(void) {
     SETUP_STACK();
     setup_system();
     precalculate();
+    reset_glyphs();
     clear_screen();
     init_variables();
     show_title();
@@ -1825,3 +2526,104 @@ void reset(void) {
     top_level();
     for (;;) { }
 }
+
+#if defined(HOST)
+byte host_level(void) {
+    return level;
+}
+
+byte host_levels(void) {
+    return SIZE(level_list);
+}
+
+/* scheduler counters, both wrap and are read as deltas every frame */
+word host_slices(void) {
+    return sprite_task.slices + runner_task.slices;
+}
+
+word host_idle_spins(void) {
+    return idle_spins;
+}
+
+#if !defined(BLOCKS)
+/* text blocks for moonrn-host -t, drawn on a blank screen */
+void host_text(byte block) {
+    precalculate();
+    reset_glyphs();
+    switch (block) {
+    case 0:
+	show_intro_text();
+	break;
+    case 1:
+	put_lines(p_done, 88);
+	break;
+    case 2:
+	put_lines(outro, 88);
+	break;
+    case 3:
+	game_over_text();
+	break;
+    }
+}
+#endif
+
+byte *host_row(byte y) {
+    return ROW(y);
+}
+
+/* an image of data.h as pcx-dump read it, see host.c */
+struct HostImage {
+    const char *name;
+    const byte *pixel;
+    word pixel_size;
+    const byte *color;
+    word color_size;
+    byte w, h;
+};
+
+#define HOST_IMAGE(name)	{ #name, &name, &name##_ref }
+static const struct {
+    const char *name;
+    const struct Image *img, *ref;
+} host_images[] = {
+    HOST_IMAGE(title),
+    HOST_IMAGE(horizon),
+    HOST_IMAGE(reward),
+    HOST_IMAGE(deed),
+    HOST_IMAGE(credits),
+    HOST_IMAGE(hazard),
+    HOST_IMAGE(select),
+    HOST_IMAGE(joystick),
+    HOST_IMAGE(sadstick),
+};
+
+/* draw image i on a blank screen for moonrn-host -i, 0 past the last */
+byte host_image(byte i, struct HostImage *out) {
+    if (i >= SIZE(host_images)) return 0;
+    const struct Image *ref = host_images[i].ref;
+    precalculate();
+    clear_screen();
+    display_image(host_images[i].img, 0, 0);
+    out->name = host_images[i].name;
+    out->pixel = ref->pixel;
+    out->pixel_size = ref->pixel_size;
+#if defined(ZXS)
+    out->color = ref->color;
+    out->color_size = ref->color_size;
+#else
+    out->color = NULL;
+    out->color_size = 0;
+#endif
+    out->w = ref->w;
+    out->h = ref->h;
+    return 1;
+}
+
+void host_start(byte run, byte first) {
+    host_first = first;
+    run_num = run;
+    use_joy = 0;
+    max_run = run > 1 ? run : 1;
+    reset();
+}
+#endif
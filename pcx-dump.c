@@ -7,6 +7,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <math.h>
+#include <ctype.h>
 
 static char option;
 
@@ -110,20 +111,22 @@ static int min(int a, int b) {
     return a < b ? a : b;
 }
 
+/* longest match of at most size bytes, the farthest one of equal length */
 static int back(unsigned char *src, int pos, int size, int *ret) {
     pos = min(255, pos);
     if (size > pos) size = pos;
 
-    for (int i = size; i > 1; i--) {
-	for (int x = pos; x >= size; x--) {
-	    if (memcmp(src - x, src, i) == 0) {
-		*ret = x;
-		return i;
-	    }
+    int best = 1;
+    for (int x = pos; x >= size; x--) {
+	int i = 0;
+	while (i < size && src[i - x] == src[i]) i++;
+	if (i > best) {
+	    best = i;
+	    *ret = x;
 	}
     }
 
-    return 0;
+    return best > 1 ? best : 0;
 }
 
 #define WINDOW 64
@@ -161,7 +164,7 @@ static int compress(unsigned char *dst, unsigned char *src, int size) {
 
     while (pos < size) {
 	int b = 0;
-	int c = win(size);
+	int c = win(size - pos);
 	int e = equals(src, c);
 	int n = back(src, pos, c, &b);
 
@@ -189,7 +192,7 @@ static int compress(unsigned char *dst, unsigned char *src, int size) {
 }
 
 static void remove_extension(char *src, char *dst) {
-    for (int i = 0; i < strlen(src); i++) {
+    for (size_t i = 0; i < strlen(src); i++) {
 	if (src[i] == '.') {
 	    dst[i] = 0;
 	    return;
@@ -217,6 +220,7 @@ static void dump_buffer(void *ptr, int size, int step) {
     if ((size & 7) != 0) printf("\n");
 }
 
+#if defined(ZXS)
 static unsigned short encode_pixel(unsigned char a, unsigned char b) {
     return a > b ? (b << 8) | a : (a << 8) | b;
 }
@@ -228,7 +232,6 @@ static unsigned char encode_ink(unsigned short colors) {
     return l | (f & 7) | ((b & 7) << 3);
 }
 
-#if defined(ZXS)
 #define PiB 8
 static unsigned char consume_pixels(unsigned char *buf, unsigned char on) {
     unsigned char ret = 0;
@@ -252,6 +255,7 @@ static unsigned char consume_pixels(unsigned char *buf) {
 }
 #endif
 
+#if defined(ZXS)
 static int ink_index(int i) {
     return (i / header.w / 8) * (header.w / 8) + i % header.w / 8;
 }
@@ -269,6 +273,7 @@ static unsigned short on_pixel(unsigned char *buf, int i, int w) {
     }
     return pixel == 0 ? 0x1 : pixel;
 }
+#endif
 
 static void compress_and_save(char *name, char *post, void *buf, int size) {
     unsigned char tmp[2 * size];
@@ -283,8 +288,39 @@ static void save_image_entry(char *name, char *type) {
     printf(" .%s_size = sizeof(%s_%s),\n", type, name, type);
 }
 
+/*
+ * the image as the first release stored it, one plain run of pixels and
+ * of colours before any cell is flipped or line filtered; moonrn-host -i
+ * decodes it the old way and compares it with what main.c draws
+ */
+static void save_ref(unsigned char *pixel, int pixel_size,
+		     unsigned char *color, int color_size) {
+    char name[256];
+    remove_extension(header.name, name);
+    strcat(name, "_ref");
+#if defined(CPC)
+    (void) color; (void) color_size;
+#endif
+
+    printf("#if defined(HOST)\n");
+    compress_and_save(name, "pixel", pixel, pixel_size);
+#if defined(ZXS)
+    compress_and_save(name, "color", color, color_size);
+#endif
+    printf("static const struct Image %s = {\n", name);
+    save_image_entry(name, "pixel");
+#if defined(ZXS)
+    save_image_entry(name, "color");
+#endif
+    printf(" .w = %d,", header.w / PiB);
+    printf(" .h = %d,\n", header.h / 8);
+    printf("};\n");
+    printf("#endif\n");
+}
+
 static void save_scr(unsigned char *pixel, int pixel_size,
 		     unsigned char *color, int color_size) {
+    (void) pixel_size;
     for (int y = 0; y < 192; y++) {
 	for (int x = 0; x < 32; x++) {
 	    int f = ((y & 7) << 3) | ((y >> 3) & 7) | (y & 0xc0);
@@ -296,22 +332,284 @@ static void save_scr(unsigned char *pixel, int pixel_size,
     }
 }
 
+#if defined(CPC)
+/*
+ * a full width CPC image in screen order, every pixel line of its cells is
+ * one block with the 16 bytes right of the game area cleared between the
+ * cells; on ZX -d always came out smaller, so there is no ZX -n
+ */
+#define NATIVE_WIDTH		64
+#define NATIVE_LINE(rows)	((rows) * 80 - 16)
+#define NATIVE_BLOCKS		8
+
+static void native_order(unsigned char *dst, unsigned char *pixel, int rows) {
+    memset(dst, 0, NATIVE_BLOCKS * NATIVE_LINE(rows));
+    for (int y = 0; y < rows * 8; y++) {
+	int offset = (y & 7) * NATIVE_LINE(rows) + (y >> 3) * 80;
+	memcpy(dst + offset, pixel + y * NATIVE_WIDTH, NATIVE_WIDTH);
+    }
+}
+
+/* every block of size bytes is compressed on its own, back to back */
+static void compress_blocks(char *name, char *post, unsigned char *buf,
+			    int size, int blocks) {
+    unsigned char tmp[2 * size * blocks];
+    int count = 0;
+    for (int i = 0; i < blocks; i++) {
+	count += compress(tmp + count, buf + i * size, size);
+    }
+    printf("static const byte %s_%s[] = {\n", name, post);
+    dump_buffer(tmp, count, 1);
+    printf("};\n");
+}
+#endif
+
+/*
+ * an image as one byte per 8x8 cell naming its pixels in the set of distinct
+ * cells, dst gets the cell count followed by the compressed map and set
+ */
+#define CELL_BYTES	(8 / PiB)
+#define TILE_BYTES	(8 * CELL_BYTES)
+
+/* main.c unpacks map and set to TEMP_BUF, up to the next area in use */
+#if defined(ZXS)
+#define TEMP_SIZE	(0x8000 - 0x5b00)
+#elif defined(CPC)
+#define TEMP_SIZE	(0xC000 - 0xa000)
+#endif
+
+static int tile_image(unsigned char *dst, unsigned char *pixel, int *tiles) {
+    int line = header.w / PiB;
+    int cols = header.w / 8;
+    int cells = cols * header.h / 8;
+    unsigned char set[255 * TILE_BYTES];
+    unsigned char map[cells];
+    int count = 0;
+
+    for (int i = 0; i < cells; i++) {
+	unsigned char tile[TILE_BYTES];
+	unsigned char *src = pixel + (i / cols) * 8 * line;
+	src += (i % cols) * CELL_BYTES;
+	for (int y = 0; y < 8; y++) {
+	    memcpy(tile + y * CELL_BYTES, src + y * line, CELL_BYTES);
+	}
+	int t = 0;
+	while (t < count && memcmp(set + t * TILE_BYTES, tile, TILE_BYTES)) {
+	    t++;
+	}
+	if (t == count) {
+	    if (count == 255) {
+		fprintf(stderr, "ERROR %s has too many cells\n", header.name);
+		exit(-EINVAL);
+	    }
+	    memcpy(set + t * TILE_BYTES, tile, TILE_BYTES);
+	    count++;
+	}
+	map[i] = t;
+    }
+
+    if (cells + count * TILE_BYTES > TEMP_SIZE) {
+	fprintf(stderr, "ERROR %s does not fit TEMP_BUF\n", header.name);
+	exit(-EINVAL);
+    }
+    dst[0] = count;
+    int size = 1 + compress(dst + 1, map, cells);
+    size += compress(dst + size, set, count * TILE_BYTES);
+    *tiles = count;
+    return size;
+}
+
+/* bytes of the pixel stream save_image writes for the option */
+static int pixel_bytes(unsigned char *pixel, int pixel_size) {
+    unsigned char tmp[2 * (pixel_size + 255 * TILE_BYTES)];
+    int tiles;
+
+    switch (option) {
+    case 'd':
+	return tile_image(tmp, pixel, &tiles);
+#if defined(CPC)
+    case 'n': {
+	int rows = header.h / 8;
+	int size = 0;
+	unsigned char native[NATIVE_BLOCKS * NATIVE_LINE(rows)];
+	native_order(native, pixel, rows);
+	for (int i = 0; i < NATIVE_BLOCKS; i++) {
+	    size += compress(tmp, native + i * NATIVE_LINE(rows),
+			     NATIVE_LINE(rows));
+	}
+	return size;
+    }
+#endif
+    default:
+	return compress(tmp, pixel, pixel_size);
+    }
+}
+
+/*
+ * every pixel line but the first as the difference to the line above it,
+ * main.c undoes it after decoding, filter 0 leaves the pixels be
+ */
+#define FILTERS 3
+
+/* Image.mode bits above the filter, as main.c reads them */
+#define MODE_NATIVE	4
+#define MODE_TILES	8
+
+static void filter_lines(unsigned char *dst, unsigned char *pixel,
+			 int pixel_size, int filter) {
+    int line = header.w / PiB;
+    for (int i = 0; i < pixel_size; i++) {
+	unsigned char up = i < line ? 0 : pixel[i - line];
+	switch (filter) {
+	case 0:
+	    dst[i] = pixel[i];
+	    break;
+	case 1:
+	    dst[i] = pixel[i] ^ up;
+	    break;
+	case 2:
+	    dst[i] = pixel[i] - up;
+	    break;
+	}
+    }
+}
+
+/* the filter giving the fewest pixel bytes, tiles are never filtered */
+static int best_filter(unsigned char *pixel, int pixel_size, int *bytes) {
+    int filters = option == 'd' ? 1 : FILTERS;
+    unsigned char tmp[pixel_size];
+    int best = 0;
+    for (int f = 0; f < filters; f++) {
+	filter_lines(tmp, pixel, pixel_size, f);
+	bytes[f] = pixel_bytes(tmp, pixel_size);
+	if (bytes[f] < bytes[best]) best = f;
+    }
+    return best;
+}
+
+#if defined(ZXS)
+/* bytes of a -c or -d image, the ones save_image writes */
+static int image_size(unsigned char *pixel, int pixel_size,
+		      unsigned char *color, int color_size) {
+    unsigned char tmp[2 * color_size];
+    int bytes[FILTERS];
+    int size = compress(tmp, color, color_size);
+    return size + bytes[best_filter(pixel, pixel_size, bytes)];
+}
+
+/* the game draws on these expecting ink on set pixels, keep them as is */
+static int fixed_cells(void) {
+    return is_file("horizon.pcx") || is_file("select.pcx")
+	|| is_file("joystick.pcx") || is_file("sadstick.pcx");
+}
+
+static void flip_cell(unsigned char *pixel, unsigned char *color, int i) {
+    int line = header.w / 8;
+    unsigned char *src = pixel + (i / line) * 8 * line + i % line;
+    for (int y = 0; y < 8; y++) {
+	src[y * line] = ~src[y * line];
+    }
+    unsigned char ink = color[i] & 0x07;
+    unsigned char paper = (color[i] >> 3) & 0x07;
+    color[i] = (color[i] & 0xc0) | (ink << 3) | paper;
+}
+
+/* swap ink and paper of any cell while that makes the image smaller */
+static void orient_cells(unsigned char *pixel, int pixel_size,
+			 unsigned char *color, int color_size) {
+    int before = image_size(pixel, pixel_size, color, color_size);
+    int best = before;
+    int better = 1;
+    while (better) {
+	better = 0;
+	for (int i = 0; i < color_size; i++) {
+	    flip_cell(pixel, color, i);
+	    int size = image_size(pixel, pixel_size, color, color_size);
+	    if (size < best) {
+		best = size;
+		better = 1;
+	    }
+	    else {
+		flip_cell(pixel, color, i);
+	    }
+	}
+    }
+    fprintf(stderr, "%s: %d bytes, %d with cells flipped\n",
+	    header.name, before, best);
+}
+#endif
+
 static void save_image(unsigned char *pixel, int pixel_size,
 		       unsigned char *color, int color_size) {
 
     char name[256];
     remove_extension(header.name, name);
+#if defined(CPC)
+    (void) color; (void) color_size;
+#endif
 
-    compress_and_save(name, "pixel", pixel, pixel_size);
+    int tiles = 0;
 #if defined(ZXS)
-    compress_and_save(name, "color", color, color_size);
+    if (option == 'n') {
+	fprintf(stderr, "ERROR -n is CPC only, use -d for %s\n", header.name);
+	exit(-EINVAL);
+    }
+#elif defined(CPC)
+    int rows = header.h / 8;
+    if (option == 'n' && header.w / PiB != NATIVE_WIDTH) {
+	fprintf(stderr, "ERROR %s is not full width\n", header.name);
+	exit(-EINVAL);
+    }
+#endif
+
+    int bytes[FILTERS];
+    int filter = best_filter(pixel, pixel_size, bytes);
+    if (option != 'd') {
+	fprintf(stderr, "%s: %d bytes, %d with xor, %d with delta\n",
+		header.name, bytes[0], bytes[1], bytes[2]);
+	unsigned char tmp[pixel_size];
+	filter_lines(tmp, pixel, pixel_size, filter);
+	memcpy(pixel, tmp, pixel_size);
+    }
+
+    if (option == 'd') {
+	unsigned char tmp[2 * (pixel_size + 255 * TILE_BYTES)];
+	int size = tile_image(tmp, pixel, &tiles);
+	int flat = compress(tmp + size, pixel, pixel_size);
+	fprintf(stderr, "%s: %d cells, %d bytes, %d as -c, %d in TEMP_BUF\n",
+		header.name, tiles, size, flat,
+		header.w / 8 * header.h / 8 + tiles * TILE_BYTES);
+	printf("static const byte %s_pixel[] = {\n", name);
+	dump_buffer(tmp, size, 1);
+	printf("};\n");
+#if defined(ZXS)
+	compress_and_save(name, "color", color, color_size);
+#endif
+    }
+#if defined(CPC)
+    else if (option == 'n') {
+	unsigned char native[NATIVE_BLOCKS * NATIVE_LINE(rows)];
+	native_order(native, pixel, rows);
+	compress_blocks(name, "pixel", native, NATIVE_LINE(rows),
+			NATIVE_BLOCKS);
+    }
 #endif
+    else {
+	compress_and_save(name, "pixel", pixel, pixel_size);
+#if defined(ZXS)
+	compress_and_save(name, "color", color, color_size);
+#endif
+    }
 
     printf("static const struct Image %s = {\n", name);
     save_image_entry(name, "pixel");
 #if defined(ZXS)
     save_image_entry(name, "color");
 #endif
+    int mode = filter;
+    if (option == 'n') mode |= MODE_NATIVE;
+    if (option == 'd') mode |= MODE_TILES;
+    if (mode) printf(" .mode = %d,\n", mode);
     printf(" .w = %d,", header.w / PiB);
     printf(" .h = %d,\n", header.h / 8);
     printf("};\n");
@@ -325,15 +623,43 @@ static void save_raw(unsigned char *pixel, int pixel_size, char *extra) {
     printf("};\n");
 }
 
+static void save_block(char *file) {
+    struct stat st;
+    char name[256], upper[256];
+    if (stat(file, &st) != 0 || st.st_size < 4) {
+	fprintf(stderr, "ERROR while opening block \"%s\"\n", file);
+	exit(-ENOENT);
+    }
+    unsigned char *buf = malloc(st.st_size);
+    int in = open(file, O_RDONLY);
+    read(in, buf, st.st_size);
+    close(in);
+
+    remove_extension(file, name);
+    for (size_t i = 0; i <= strlen(name); i++) {
+	upper[i] = toupper(name[i]);
+    }
+
+    compress_and_save(name, "pixel", buf + 4, st.st_size - 4);
+    printf("static const struct Image %s = {\n", name);
+    save_image_entry(name, "pixel");
+    printf(" .w = %d,", buf[2]);
+    printf(" .h = %d,\n", buf[3]);
+    printf("};\n");
+    printf("#define %s_X %d\n", upper, buf[0]);
+    printf("#define %s_Y %d\n", upper, buf[1]);
+    free(buf);
+}
+
 static void save_bitmap(unsigned char *buf, int size) {
-    int j = 0;
     int pixel_size = size / PiB;
     int color_size = size / 64;
     unsigned char pixel[pixel_size];
     unsigned char color[color_size];
-    unsigned short on[color_size];
 
 #if defined(ZXS)
+    unsigned short on[color_size];
+    int j = 0;
     for (int i = 0; i < size; i += 8) {
 	if (i / header.w % 8 == 0) {
 	    on[j++] = on_pixel(buf, i, header.w);
@@ -344,16 +670,27 @@ static void save_bitmap(unsigned char *buf, int size) {
     for (int i = 0; i < color_size; i++) {
 	color[i] = encode_ink(on[i]);
     }
+    if (option == 'c' || option == 'd') {
+	save_ref(pixel, pixel_size, color, color_size);
+    }
+    if ((option == 'c' || option == 'd') && !fixed_cells()) {
+	orient_cells(pixel, pixel_size, color, color_size);
+    }
 #endif
 
 #if defined(CPC)
     for (int i = 0; i < size; i += PiB) {
 	pixel[i / PiB] = consume_pixels(buf + i);
     }
+    if (option == 'c' || option == 'n' || option == 'd') {
+	save_ref(pixel, pixel_size, color, color_size);
+    }
 #endif
 
     switch (option) {
     case 'c':
+    case 'n':
+    case 'd':
 	save_image(pixel, pixel_size, color, color_size);
 	break;
     case 's':
@@ -424,6 +761,49 @@ static void save_level(unsigned char *buf) {
     save_raw(level, sizeof(level), "");
 }
 
+static void save_tables(void) {
+    unsigned char row[2 * 192];
+    for (int y = 0; y < 192; y++) {
+	unsigned short addr = pixel_addr(0, y);
+	row[y] = addr & 0xff;
+	row[y + 192] = addr >> 8;
+    }
+    printf("#if !defined(LEAN)\n");
+    printf("static const byte row_table[] = {\n");
+    dump_buffer(row, sizeof(row), 1);
+    printf("};\n");
+    printf("#endif\n");
+}
+
+static void save_metrics(const char *file) {
+    unsigned char font[96 * 8];
+    unsigned char metrics[96];
+    int in = open(file, O_RDONLY);
+    if (in < 0 || read(in, font, sizeof(font)) != sizeof(font)) {
+	fprintf(stderr, "ERROR while reading font \"%s\"\n", file);
+	exit(-ENOENT);
+    }
+    close(in);
+
+    for (int i = 0; i < 96; i++) {
+	int lead, trail;
+	unsigned char mask = 0;
+	for (int j = 0; j < 8; j++) {
+	    mask |= font[i * 8 + j];
+	}
+	for (lead = 0; lead < 8; lead++) {
+	    if (mask & (0x80 >> lead)) break;
+	}
+	for (trail = 0; trail < 8; trail++) {
+	    if (mask & (1 << trail)) break;
+	}
+	metrics[i] = (lead << 4) | (8 - trail);
+    }
+    printf("static const byte font_metrics[] = {\n");
+    dump_buffer(metrics, sizeof(metrics), 1);
+    printf("};\n");
+}
+
 static unsigned char *read_pcx(const char *file) {
     struct stat st;
     int palette_offset = 16;
@@ -466,18 +846,36 @@ static unsigned char *read_pcx(const char *file) {
 }
 
 int main(int argc, char **argv) {
+    if (argc == 2 && strcmp(argv[1], "-t") == 0) {
+	save_tables();
+	return 0;
+    }
     if (argc < 3) {
 	printf("USAGE: pcx-dump [option] file.pcx\n");
 	printf("  -c   save compressed image\n");
+	printf("  -n   save compressed full width CPC image in screen order\n");
+	printf("  -d   save image as a map of distinct 8x8 cells\n");
 	printf("  -p   save raw pixel data\n");
 	printf("  -l   save level data\n");
 	printf("  -s   save .scr file\n");
+	printf("  -t   save screen row tables, takes no file\n");
+	printf("  -f   save font metrics of font.rom\n");
+	printf("  -b   save text block written by moonrn-host -t\n");
 	return 0;
     }
 
     option = argv[1][1];
     header.name = argv[2];
 
+    if (option == 'f') {
+	save_metrics(header.name);
+	return 0;
+    }
+    if (option == 'b') {
+	save_block(header.name);
+	return 0;
+    }
+
     void *buf = read_pcx(header.name);
     if (buf == NULL) return -ENOENT;
 
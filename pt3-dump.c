@@ -0,0 +1,584 @@
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+
+/* C port of the PT3 decoder in PT3player.c, renders AY register frames */
+
+typedef unsigned char byte;
+typedef unsigned short word;
+
+#define AY_ToneA	0
+#define AY_ToneB	2
+#define AY_ToneC	4
+#define AY_Noise	6
+#define AY_Mixer	7
+#define AY_AmpA		8
+#define AY_AmpB		9
+#define AY_AmpC		10
+#define AY_EnvPeriod	11
+#define AY_EnvShape	13
+#define AY_REGS		14
+
+#define EMPTYSAMORN	0xfff0
+#define MAX_FRAMES	0x8000
+
+#if defined(ZXS)
+static const word NT[96] = {
+    0xD3D,0xC7F,0xBCC,0xB22,0xA82,0x9EB,0x95D,0x8D6,0x857,0x7DF,0x76E,0x703,
+    0x69F,0x640,0x5E6,0x591,0x541,0x4F6,0x4AE,0x46B,0x42C,0x3F0,0x3B7,0x382,
+    0x34F,0x320,0x2F3,0x2C9,0x2A1,0x27B,0x257,0x236,0x216,0x1F8,0x1DC,0x1C1,
+    0x1A8,0x190,0x179,0x164,0x150,0x13D,0x12C,0x11B,0x10B,0x0FC,0x0EE,0x0E0,
+    0x0D4,0x0C8,0x0BD,0x0B2,0x0A8,0x09F,0x096,0x08D,0x085,0x07E,0x077,0x070,
+    0x06A,0x064,0x05E,0x059,0x054,0x04F,0x04B,0x047,0x043,0x03F,0x03B,0x038,
+    0x035,0x032,0x02F,0x02D,0x02A,0x028,0x025,0x023,0x021,0x01F,0x01E,0x01C,
+    0x01A,0x019,0x018,0x016,0x015,0x014,0x013,0x012,0x011,0x010,0x00F,0x00E,
+};
+#endif
+
+#if defined(CPC)
+static const word NT[96] = {
+    0x777,0x70C,0x6A7,0x647,0x5ED,0x598,0x547,0x4FC,0x4B4,0x470,0x431,0x3F4,
+    0x3BC,0x386,0x353,0x324,0x2F6,0x2CC,0x2A4,0x27E,0x25A,0x238,0x218,0x1FA,
+    0x1DE,0x1C3,0x1AA,0x192,0x17B,0x166,0x152,0x13F,0x12D,0x11C,0x10C,0x0FD,
+    0x0EF,0x0E1,0x0D5,0x0C9,0x0BE,0x0B3,0x0A9,0x09F,0x096,0x08E,0x086,0x07F,
+    0x077,0x071,0x06A,0x064,0x05F,0x059,0x054,0x050,0x04B,0x047,0x043,0x03F,
+    0x03C,0x038,0x035,0x032,0x02F,0x02D,0x02A,0x028,0x026,0x024,0x022,0x020,
+    0x01E,0x01C,0x01B,0x019,0x018,0x016,0x015,0x014,0x013,0x012,0x011,0x010,
+    0x00F,0x00E,0x00D,0x00D,0x00C,0x00B,0x00B,0x00A,0x009,0x009,0x008,0x008,
+};
+#endif
+
+struct Channel {
+    byte PsInOr, PsInSm, CrAmSl, CrNsSl, CrEnSl, TSlCnt;
+    word CrTnSl, TnAcc;
+    byte COnOff, OnOffD, OffOnD;
+    word OrnPtr, SamPtr;
+    byte NNtSkp, Note, SlToNt, Env_En, Flags, TnSlDl;
+    word TSlStp, TnDelt;
+    byte NtSkCn, Volume;
+    word AdInPt;
+};
+
+static byte mem[0x10000];
+static byte VT[256];
+static byte AYREGS[AY_REGS];
+static struct Channel chan[3];
+
+static byte DelyCnt, CurEDel, Ns_Base, AddToNs;
+static word CurESld, EnvBase;
+static byte Delay, AddToEn, Env_Del, PrNote;
+static word ESldAdd, PrSlide;
+static word CrPsPtr, LPosPtr, PatsPtr, OrnPtrs, SamPtrs;
+static int song_end;
+static FILE *raw;
+
+static word peek_word(word addr) {
+    return mem[addr] | (mem[(word) (addr + 1)] << 8);
+}
+
+static void init_volume_table(void) {
+    word de = 0;
+    memset(VT, 0, sizeof(VT));
+    for (int v = 1; v < 16; v++) {
+	word hl = 0;
+	de += 0x11;
+	for (int i = 0; i < 16; i++) {
+	    VT[(v << 4) + i] = (hl >> 8) + ((hl >> 7) & 1);
+	    hl += de;
+	}
+	if ((de & 0xff) == 0x77) de++;
+    }
+}
+
+static void init_song(void) {
+    memset(chan, 0, sizeof(chan));
+    memset(AYREGS, 0, sizeof(AYREGS));
+    DelyCnt = 1;
+    CurESld = CurEDel = Ns_Base = AddToNs = EnvBase = 0;
+    AddToEn = Env_Del = ESldAdd = 0;
+
+    Delay = mem[100];
+    CrPsPtr = 200;
+    LPosPtr = 201 + mem[102];
+    PatsPtr = peek_word(103);
+    OrnPtrs = 169;
+    SamPtrs = 105;
+
+    mem[EMPTYSAMORN + 0] = 0;
+    mem[EMPTYSAMORN + 1] = 1;
+    mem[EMPTYSAMORN + 2] = 0;
+    mem[EMPTYSAMORN + 3] = 0x90;
+    for (int i = 0; i < 3; i++) {
+	chan[i].NtSkCn = 1;
+	chan[i].Volume = 0xf0;
+	chan[i].OrnPtr = EMPTYSAMORN;
+	chan[i].SamPtr = EMPTYSAMORN;
+    }
+    chan[0].AdInPt = EMPTYSAMORN;
+}
+
+static void set_orn(struct Channel *ch, byte n) {
+    ch->PsInOr = 0;
+    ch->OrnPtr = peek_word(OrnPtrs + 2 * n);
+}
+
+static void set_sam(struct Channel *ch, byte offset) {
+    ch->SamPtr = peek_word(SamPtrs + offset);
+}
+
+static void set_env(struct Channel *ch, byte shape, word *bc) {
+    ch->Env_En = 0x10;
+    AYREGS[AY_EnvShape] = shape;
+    EnvBase = (mem[*bc] << 8) | mem[(word) (*bc + 1)];
+    *bc += 2;
+    ch->PsInOr = 0;
+    CurEDel = 0;
+    CurESld = 0;
+}
+
+static void set_step(struct Channel *ch, byte lo, byte hi) {
+    ch->TSlStp = (hi << 8) | lo;
+    ch->COnOff = 0;
+}
+
+static void command(struct Channel *ch, byte cmd, word *bc) {
+    byte lo, hi;
+    word hl, de;
+    switch (cmd) {
+    case 1: /* glissando */
+	ch->Flags |= 4;
+	ch->TnSlDl = ch->TSlCnt = mem[(*bc)++];
+	lo = mem[(*bc)++];
+	hi = mem[(*bc)++];
+	set_step(ch, lo, hi);
+	break;
+    case 2: /* portamento */
+	ch->Flags &= ~4;
+	ch->TnSlDl = ch->TSlCnt = mem[(*bc)++];
+	*bc += 2;
+	ch->SlToNt = ch->Note;
+	hl = NT[ch->Note];
+	ch->Note = PrNote;
+	hl = hl - NT[PrNote];
+	ch->TnDelt = hl;
+	ch->CrTnSl = de = PrSlide;
+	lo = mem[(*bc)++];
+	hi = mem[(*bc)++];
+	if (hi != 0) { word t = hl; hl = de; de = t; }
+	hl = hl - de;
+	if (hl & 0x8000) {
+	    hi = ~hi;
+	    lo = -lo;
+	}
+	set_step(ch, lo, hi);
+	break;
+    case 3: /* sample position */
+	ch->PsInSm = mem[(*bc)++];
+	break;
+    case 4: /* ornament position */
+	ch->PsInOr = mem[(*bc)++];
+	break;
+    case 5: /* vibrato */
+	ch->OnOffD = ch->COnOff = mem[(*bc)++];
+	ch->OffOnD = mem[(*bc)++];
+	ch->TSlCnt = 0;
+	ch->CrTnSl = 0;
+	break;
+    case 8: /* envelope glide */
+	Env_Del = CurEDel = mem[(*bc)++];
+	ESldAdd = peek_word(*bc);
+	*bc += 2;
+	break;
+    case 9: /* delay */
+	Delay = mem[(*bc)++];
+	break;
+    }
+}
+
+static void reset_channel(struct Channel *ch) {
+    ch->PsInOr = ch->PsInSm = ch->CrAmSl = ch->CrNsSl = ch->CrEnSl = 0;
+    ch->TSlCnt = ch->COnOff = ch->OnOffD = 0;
+    ch->CrTnSl = ch->TnAcc = 0;
+}
+
+static word pattern_decode(struct Channel *ch, word bc) {
+    byte stack[32];
+    int depth = 0;
+
+    PrNote = ch->Note;
+    PrSlide = ch->CrTnSl;
+
+    for (;;) {
+	byte a = mem[bc++];
+	if (a >= 0xf0) {
+	    ch->Env_En = 0;
+	    set_orn(ch, a - 0xf0);
+	    set_sam(ch, mem[bc++] & 0xfe);
+	}
+	else if (a == 0xd0) {
+	    break;
+	}
+	else if (a > 0xd0) {
+	    set_sam(ch, (a - 0xd0) << 1);
+	}
+	else if (a == 0xc0) {
+	    ch->Flags &= ~1;
+	    reset_channel(ch);
+	    break;
+	}
+	else if (a > 0xc0) {
+	    ch->Volume = (a - 0xc0) << 4;
+	}
+	else if (a == 0xb0) {
+	    ch->Env_En = 0;
+	    ch->PsInOr = 0;
+	}
+	else if (a == 0xb1) {
+	    ch->NNtSkp = mem[bc++];
+	}
+	else if (a > 0xb1) {
+	    set_env(ch, a - 0xb1, &bc);
+	}
+	else if (a >= 0x50) {
+	    ch->Note = a - 0x50;
+	    ch->Flags |= 1;
+	    reset_channel(ch);
+	    break;
+	}
+	else if (a >= 0x40) {
+	    set_orn(ch, a - 0x40);
+	}
+	else if (a >= 0x20) {
+	    Ns_Base = a - 0x20;
+	}
+	else if (a >= 0x10) {
+	    ch->Env_En = a - 0x10;
+	    ch->PsInOr = a - 0x10;
+	    if (a != 0x10) set_env(ch, a - 0x10, &bc);
+	    set_sam(ch, mem[bc++]);
+	}
+	else if (depth < (int) sizeof(stack)) {
+	    stack[depth++] = a;
+	}
+    }
+    ch->NtSkCn = ch->NNtSkp;
+
+    /* special commands were pushed on the stack and run after the note */
+    while (depth > 0) {
+	command(ch, stack[--depth], &bc);
+    }
+    return bc;
+}
+
+static byte clamp_volume(byte a) {
+    if (a & 0x80) a = 0;
+    return a >= 16 ? 15 : a;
+}
+
+static word channel_regs(struct Channel *ch, word tone) {
+    byte a = 0;
+    AYREGS[AY_AmpC] = 0;
+    if (ch->Flags & 1) {
+	word orn = ch->OrnPtr;
+	int8_t shift = mem[(word) (orn + 2 + ch->PsInOr)];
+	byte next = ch->PsInOr + 1;
+	ch->PsInOr = next >= mem[orn + 1] ? mem[orn] : next;
+
+	byte note = ch->Note + shift;
+	if (note & 0x80) note = 0;
+	if (note >= 96) note = 95;
+
+	word sam = ch->SamPtr;
+	word line = sam + 2 + (byte) (ch->PsInSm << 2);
+	next = ch->PsInSm + 1;
+	ch->PsInSm = next >= mem[sam + 1] ? mem[sam] : next;
+
+	byte c = mem[line];
+	byte b = mem[(word) (line + 1)];
+	word hl = peek_word(line + 2) + ch->TnAcc;
+	if (b & 0x40) ch->TnAcc = hl;
+	tone = NT[note] + hl + ch->CrTnSl;
+
+	if (ch->TSlCnt != 0 && --ch->TSlCnt == 0) {
+	    ch->TSlCnt = ch->TnSlDl;
+	    byte hi = ch->TSlStp >> 8;
+	    word slide = ch->TSlStp + ch->CrTnSl;
+	    ch->CrTnSl = slide;
+	    if (!(ch->Flags & 4)) {
+		word x = slide, y = ch->TnDelt;
+		if (hi != 0) { x = ch->TnDelt; y = slide; }
+		if (!((word) (x - y) & 0x8000)) {
+		    ch->Note = ch->SlToNt;
+		    ch->TSlCnt = 0;
+		    ch->CrTnSl = 0;
+		}
+	    }
+	}
+
+	a = ch->CrAmSl;
+	if (c & 0x80) {
+	    if (c & 0x40) {
+		if (a != 15) ch->CrAmSl = ++a;
+	    }
+	    else {
+		if (a != (byte) -15) ch->CrAmSl = --a;
+	    }
+	}
+	a = VT[clamp_volume((b & 15) + a) | ch->Volume];
+	if (!(c & 1)) a |= ch->Env_En;
+	AYREGS[AY_AmpC] = a;
+
+	if (b & 0x80) {
+	    byte r = ((c << 2) & 0xfc) | (c >> 7);
+	    a = ((int8_t) r >> 3) + ch->CrEnSl;
+	    if (b & 0x20) ch->CrEnSl = a;
+	    AddToEn += a;
+	}
+	else {
+	    a = (c >> 1) + ch->CrNsSl;
+	    AddToNs = a;
+	    if (b & 0x20) ch->CrNsSl = a;
+	}
+	a = (b >> 1) & 0x48;
+    }
+
+    a |= AYREGS[AY_Mixer];
+    AYREGS[AY_Mixer] = (a >> 1) | (a << 7);
+
+    if (ch->COnOff != 0 && --ch->COnOff == 0) {
+	ch->Flags ^= 1;
+	ch->COnOff = (ch->Flags & 1) ? ch->OnOffD : ch->OffOnD;
+    }
+    return tone;
+}
+
+static void load_position(void) {
+    byte pos;
+    Ns_Base = 0;
+    word hl = CrPsPtr + 1;
+    if (mem[hl] == 0xff) {
+	hl = LPosPtr;
+	song_end = 1;
+    }
+    CrPsPtr = hl;
+    pos = mem[hl];
+    word ptr = PatsPtr + 2 * pos;
+    chan[0].AdInPt = peek_word(ptr + 0);
+    chan[1].AdInPt = peek_word(ptr + 2);
+    chan[2].AdInPt = peek_word(ptr + 4);
+}
+
+static void play_frame(void) {
+    static const byte tone_reg[] = { AY_ToneA, AY_ToneB, AY_ToneC };
+
+    AddToEn = 0;
+    AYREGS[AY_Mixer] = 0;
+    AYREGS[AY_EnvShape] = 0xff;
+
+    if (--DelyCnt == 0) {
+	for (int i = 0; i < 3; i++) {
+	    struct Channel *ch = chan + i;
+	    if (--ch->NtSkCn == 0) {
+		if (i == 0 && mem[ch->AdInPt] == 0) load_position();
+		ch->AdInPt = pattern_decode(ch, ch->AdInPt);
+	    }
+	}
+	DelyCnt = Delay;
+    }
+
+    for (int i = 0; i < 3; i++) {
+	byte *reg = AYREGS + tone_reg[i];
+	word tone = channel_regs(chan + i, reg[0] | (reg[1] << 8));
+	reg[0] = tone & 0xff;
+	reg[1] = tone >> 8;
+	AYREGS[AY_AmpA + i] = AYREGS[AY_AmpC];
+    }
+
+    AYREGS[AY_Noise] = Ns_Base + AddToNs;
+    word env = EnvBase + (int8_t) AddToEn + CurESld;
+    AYREGS[AY_EnvPeriod + 0] = env & 0xff;
+    AYREGS[AY_EnvPeriod + 1] = env >> 8;
+
+    if (CurEDel != 0 && --CurEDel == 0) {
+	CurEDel = Env_Del;
+	CurESld += ESldAdd;
+    }
+}
+
+/*
+ * Stream tokens, one per frame unless noted:
+ *   0x00-0x7f  literal: two mask bytes (registers 0-6, 7-13) and values
+ *   0x80-0xbf  reference: replay n tokens located d bytes back (word d)
+ *   0xc0       end of song: word offset of the loop token follows
+ *   0xc1-0xff  no register changes for n frames
+ */
+
+#define MAX_REF		64
+#define MAX_WAIT	63
+
+struct Token {
+    byte data[2 + AY_REGS];
+    int size, frames;
+};
+
+static struct Token token[MAX_FRAMES];
+static int token_count;
+
+static void add_token(byte *prev, byte *regs, int full) {
+    struct Token *ptr = token + token_count;
+    word mask = 0;
+    int n = 2;
+    for (int i = 0; i < AY_REGS; i++) {
+	int changed = i == AY_EnvShape ? regs[i] != 0xff : regs[i] != prev[i];
+	if (changed || (full && i != AY_EnvShape)) {
+	    mask |= 1 << i;
+	    ptr->data[n++] = regs[i];
+	    prev[i] = regs[i];
+	}
+    }
+    if (mask == 0 && token_count > 0 && !full) {
+	struct Token *last = ptr - 1;
+	if (last->data[0] > 0xc0 && last->data[0] < 0xc0 + MAX_WAIT) {
+	    last->data[0]++;
+	    last->frames++;
+	    return;
+	}
+	ptr->data[0] = 0xc1;
+	ptr->size = 1;
+    }
+    else {
+	ptr->data[0] = mask & 0x7f;
+	ptr->data[1] = mask >> 7;
+	ptr->size = n;
+    }
+    ptr->frames = 1;
+    token_count++;
+}
+
+static int same_token(int i, int j) {
+    return token[i].size == token[j].size
+	&& memcmp(token[i].data, token[j].data, token[i].size) == 0;
+}
+
+static int compress_stream(byte *dst, int loop) {
+    int offset[token_count];
+    int literal[token_count];
+    int loop_offset = 0;
+    int count = 0;
+    int i = 0;
+
+    while (i < token_count) {
+	int best = 0, from = 0, gain = 0;
+	for (int j = 0; j < i; j++) {
+	    int n = 0, size = 0;
+	    while (n < MAX_REF && i + n < token_count && j + n < i
+		   && i + n != loop && literal[j + n] && same_token(i + n, j + n)) {
+		size += token[i + n].size;
+		n++;
+	    }
+	    if (n > 0 && size - 3 > gain) {
+		gain = size - 3;
+		best = n;
+		from = j;
+	    }
+	}
+	if (i == loop) loop_offset = count;
+	if (best > 0) {
+	    word distance = count + 3 - offset[from];
+	    dst[count++] = 0x80 | (best - 1);
+	    dst[count++] = distance & 0xff;
+	    dst[count++] = distance >> 8;
+	    for (int n = 0; n < best; n++) literal[i + n] = 0;
+	    i += best;
+	}
+	else {
+	    offset[i] = count;
+	    literal[i] = 1;
+	    memcpy(dst + count, token[i].data, token[i].size);
+	    count += token[i].size;
+	    i++;
+	}
+    }
+
+    dst[count++] = 0xc0;
+    dst[count++] = loop_offset & 0xff;
+    dst[count++] = loop_offset >> 8;
+    return count;
+}
+
+static int render(int *loop_frame) {
+    byte prev[AY_REGS];
+    int loop = -1;
+    int frames = 0;
+
+    song_end = 0;
+    init_song();
+    while (frames < MAX_FRAMES) {
+	word position = CrPsPtr;
+	play_frame();
+	if (song_end) break;
+	if (loop < 0 && CrPsPtr != position && CrPsPtr == LPosPtr) {
+	    loop = token_count;
+	    *loop_frame = frames;
+	}
+	add_token(prev, AYREGS, frames == 0 || loop == token_count);
+	if (raw) fwrite(AYREGS, 1, AY_REGS, raw);
+	frames++;
+    }
+    return loop < 0 ? 0 : loop;
+}
+
+static byte *read_file(const char *file, int *size) {
+    struct stat st;
+    if (stat(file, &st) != 0) {
+	fprintf(stderr, "ERROR while opening PT3-file \"%s\"\n", file);
+	return NULL;
+    }
+    byte *buf = malloc(st.st_size);
+    int in = open(file, O_RDONLY);
+    read(in, buf, st.st_size);
+    close(in);
+    *size = st.st_size;
+    return buf;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+	printf("USAGE: pt3-dump file.pt3 > file.ays\n");
+	printf("       pt3-dump -r file.pt3 > file.raw\n");
+	printf("  -r   the 14 AY registers of every frame instead\n");
+	return 0;
+    }
+    if (strcmp(argv[1], "-r") == 0 && argc > 2) {
+	raw = stdout;
+	argv++;
+    }
+
+    int size;
+    byte *buf = read_file(argv[1], &size);
+    if (buf == NULL) return -ENOENT;
+
+    /* music.pt3 is stored without the 100 byte text header */
+    memcpy(mem + 100, buf, size);
+    init_volume_table();
+    free(buf);
+
+    int loop_frame = 0;
+    int loop = render(&loop_frame);
+
+    int frames = 0;
+    for (int i = 0; i < token_count; i++) frames += token[i].frames;
+
+    byte out[frames * (2 + AY_REGS) + 3];
+    int count = compress_stream(out, loop);
+    if (!raw) fwrite(out, 1, count, stdout);
+
+    fprintf(stderr, "%s: %d frames, loop %d, raw %d, stream %d\n",
+	    argv[1], frames, loop_frame, frames * AY_REGS, count);
+    return 0;
+}
@@ -0,0 +1,1652 @@
+/* =============================================================================
+   Z80 bench harness
+
+   Runs moonrn.ihx, the bytes of moonrn.bin at the --code-loc and --data-loc
+   of the build, on a Z80 core that counts T-states. The Spectrum build gets
+   the memory and I/O contention of a 128K, or of a 48K with -4, and the CPC
+   build has every instruction stretched to whole microseconds and an
+   interrupt every 52 lines, 300 of them a second.
+
+   Addresses come from moonrn.map and, for the statics of main.c, from the
+   moonrn.cdb of a DEBUG=--debug build. The game starts at _start_up and
+   space is held for 2 frames every -j period frames, which leaves the title
+   screen and keeps the player jumping. On entry to top_level the level and
+   the run number are patched in.
+
+   usage: z80-bench [-4] [-f frames] [-j period] [-n run] [-l level]
+		    [-s folded] [-i interval] [-c function,...] [-y ay] [ihx]
+	  z80-bench [-4] -p log [ihx]
+
+   -4  48K Spectrum timing and no AY, a 128K by default
+   -f  frames played from top_level on, per level
+   -j  hold space for 2 frames every period frames, 0 never
+   -n  run number, 0 is the practice run
+   -l  bench this level only instead of every level of level_list but 0
+   -s  play one run from level -l, sample the PC every -i T-states and
+       write folded stacks, the interrupt under its own root
+   -i  T-states between samples, 1000 by default
+   -c  play one run from level -l like -s and report the T-states of every
+       call to these functions, from their first instruction to their
+       return, callees included and interrupts left out
+   -y  play one run from level -l like -s and write the 14 bytes of
+       AYREGS to this file each time Player_Decode returns, the frames
+       pt3-dump -r writes for the same tune
+   -p  play a log of moonrn-host -r from the start, its run and level, and
+       report the frames of every level it plays; the host reads a byte of
+       the log each time it idles in wait_vblank, so does this
+
+   Every level is a practice run of its own. A frame costs the T-states from
+   the interrupt that starts it to the first call of wait_vblank in it, or
+   the whole frame when the game does not idle in it, as in the beeper
+   effects of -4 or when the frame before ran over. The report is their mean, p99, max and
+   the frames that cost the whole frame.
+
+   Every report then gives the interrupts taken from top_level on and
+   their T-states, from the acceptance to the RET or RETI that pops it,
+   the music and what else the handler calls included.
+
+   The Spectrum reports end with the T-states a frame that the ULA held
+   the CPU off, at the screen and at 0x5b00-0x7fff, where main.c keeps
+   TEMP_BUF, over every frame run from the boot on.
+
+   A ZONES=-DZONES build writes ZONE_BEGIN and ZONE_END to port 0xff, which
+   nothing decodes. Every report then ends with the calls, T-states and
+   self T-states of each zone under the zone that encloses it.
+
+   The stacks of -s come from a shadow of the Z80 stack: CALL, RST and the
+   interrupt push the address returned to, RET pops it, and frames left
+   below the stack pointer, as after the ld sp of reset, are dropped. Each
+   frame is named by the function of its call site in moonrn.map and
+   moonrn.cdb.
+============================================================================= */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+typedef unsigned char byte;
+typedef unsigned short word;
+typedef signed char int8;
+
+#define FC	0x01
+#define FN	0x02
+#define FV	0x04
+#define FX	0x08
+#define FH	0x10
+#define FY	0x20
+#define FZ	0x40
+#define FS	0x80
+
+#if defined(ZXS)
+#define ROM_TOP		0x4000
+#elif defined(CPC)
+#define FRAME_T		79872	/* 312 lines of 64 us */
+#define IRQ_T		13312	/* the gate array counts 52 lines */
+#define VSYNC_T		2048
+#endif
+
+/* the order of the register fields of the opcodes, F sits in (HL)'s place */
+enum { R_B, R_C, R_D, R_E, R_H, R_L, R_F, R_A };
+
+#define A	reg[R_A]
+#define F	reg[R_F]
+
+static byte mem[0x10000];
+static byte reg[8];
+static byte alt[8];
+static byte index_reg[2][2];	/* IX and IY, high byte first */
+static word sp, pc;
+static byte ir_i, ir_r;
+static byte iff1, iff2, im;
+static byte ei_just;
+static byte halted;
+
+static long t;			/* T-states into the current frame */
+static unsigned long long past;	/* T-states of the frames before */
+#define NOW		(past + t)
+
+static byte sz53[256];
+static byte sz53p[256];
+
+static byte space;
+
+#if defined(ZXS)
+static long frame_t = 70908;
+static long contended_t = 14361;
+static long line_t = 228;
+static long int_t = 36;
+static byte has_ay = 1;
+static byte int_taken;
+static byte ay_sel;
+static byte ay_reg[16];
+
+/* the ULA holds the CPU off while it fetches the screen */
+static void ula_delay(void) {
+    static const byte pattern[8] = { 6, 5, 4, 3, 2, 1, 0, 0 };
+    long at = t - contended_t;
+    if (at >= 0 && at < 192 * line_t && at % line_t < 128) {
+	t += pattern[at % line_t & 7];
+    }
+}
+
+/* the waits at the screen and at the RAM above it, TEMP_BUF of main.c */
+static long ula_screen;
+static long ula_ram;
+
+static void contend(word addr) {
+    if ((addr & 0xc000) == 0x4000) {
+	long before = t;
+	ula_delay();
+	if (addr < 0x5b00) ula_screen += t - before;
+	else ula_ram += t - before;
+    }
+}
+#elif defined(CPC)
+static long frame_t = FRAME_T;
+static byte irq_next;
+static byte irq_pending;
+static byte ppi_a;
+static byte ppi_c;
+static byte psg_sel;
+
+static void contend(word addr) {
+    (void) addr;
+}
+#endif
+
+static word ir(void) {
+    return (ir_i << 8) | ir_r;
+}
+
+static byte fetch(void) {
+    contend(pc);
+    t += 4;
+    ir_r = (ir_r & 0x80) | ((ir_r + 1) & 0x7f);
+    return mem[pc++];
+}
+
+static byte read8(word addr) {
+    contend(addr);
+    t += 3;
+    return mem[addr];
+}
+
+static void write8(word addr, byte data) {
+    contend(addr);
+    t += 3;
+#if defined(ZXS)
+    if (addr < ROM_TOP) return;
+#endif
+    mem[addr] = data;
+}
+
+/* internal cycles that still put addr on the bus */
+static void idle(word addr, byte n) {
+    while (n-- > 0) {
+	contend(addr);
+	t++;
+    }
+}
+
+static byte arg8(void) {
+    return read8(pc++);
+}
+
+static word arg16(void) {
+    byte lo = read8(pc++);
+    return lo | (read8(pc++) << 8);
+}
+
+static void push16(word data) {
+    write8(--sp, data >> 8);
+    write8(--sp, data);
+}
+
+static word pop16(void) {
+    byte lo = read8(sp++);
+    return lo | (read8(sp++) << 8);
+}
+
+/* ZONES=-DZONES builds write ZONE_BEGIN and ZONE_END of main.c to port 0xff,
+   the T-states of every zone are split by enclosing zone like on the host */
+#define ZONES_MAX	16
+#define ZONE_DEPTH	8
+
+/* same order as the ZONE_ ids in main.c */
+static const char *zone_name[ZONES_MAX] = {
+    "-", "frame", "animate_player", "draw_pond_waves", "draw_player",
+    "draw_twinkle", "move_level", "Player_Decode", "uncompress",
+};
+
+static struct {
+    byte id;
+    unsigned long long start;
+    unsigned long long child;
+} zone_stack[ZONE_DEPTH];
+static byte zone_depth;
+static byte zone_seen;
+static long zone_calls[ZONES_MAX][ZONES_MAX];
+static unsigned long long zone_total[ZONES_MAX][ZONES_MAX];
+static unsigned long long zone_self[ZONES_MAX][ZONES_MAX];
+
+static void zone_mark(byte id) {
+    zone_seen = 1;
+    if (!(id & 0x80)) {
+	if (zone_depth == ZONE_DEPTH) return;
+	zone_stack[zone_depth].id = id & (ZONES_MAX - 1);
+	zone_stack[zone_depth].start = NOW;
+	zone_stack[zone_depth].child = 0;
+	zone_depth++;
+    }
+    else if (zone_depth > 0) {
+	zone_depth--;
+	byte parent = zone_depth > 0 ? zone_stack[zone_depth - 1].id : 0;
+	unsigned long long time = NOW - zone_stack[zone_depth].start;
+	id = zone_stack[zone_depth].id;
+	zone_calls[parent][id]++;
+	zone_total[parent][id] += time;
+	zone_self[parent][id] += time - zone_stack[zone_depth].child;
+	if (zone_depth > 0) zone_stack[zone_depth - 1].child += time;
+    }
+}
+
+static void zone_report(byte parent, int indent) {
+    for (byte id = 1; id < ZONES_MAX; id++) {
+	long calls = zone_calls[parent][id];
+	if (calls == 0) continue;
+	printf("%*s%-*s %8ld calls %12llu T %8.0f T/call %12llu self\n",
+	       indent, "", 20 - indent, zone_name[id], calls,
+	       zone_total[parent][id],
+	       (double) zone_total[parent][id] / calls, zone_self[parent][id]);
+	if (id != parent) zone_report(id, indent + 2);
+    }
+}
+
+#if defined(ZXS)
+static void io_contend(word port) {
+    byte high = (port & 0xc000) == 0x4000;
+    if (high) ula_delay();
+    t++;
+    if (port & 1) {
+	for (byte i = 0; i < 3; i++) {
+	    if (high) ula_delay();
+	    t++;
+	}
+    }
+    else {
+	ula_delay();
+	t += 3;
+    }
+}
+
+static byte port_in(word port) {
+    io_contend(port);
+    if ((port & 1) == 0) {
+	/* space is bit 0 of the half row selected by A15 */
+	return space && (port & 0x8000) == 0 ? 0xfe : 0xff;
+    }
+    if ((port & 0x20) == 0) return 0x00; /* Kempston, nothing pressed */
+    if (has_ay && (port & 0xc002) == 0xc000) return ay_reg[ay_sel];
+    return 0xff;
+}
+
+static void port_out(word port, byte data) {
+    io_contend(port);
+    if ((port & 0xff) == 0xff) zone_mark(data);
+    if (!has_ay || (port & 1) == 0) return;
+    if ((port & 0xc002) == 0xc000) ay_sel = data & 0x0f;
+    if ((port & 0xc002) == 0x8000) ay_reg[ay_sel] = data;
+}
+#elif defined(CPC)
+static byte port_in(word port) {
+    t += 4;
+    if (port & 0x0800) return 0xff;
+    switch ((port >> 8) & 3) {
+    case 0:
+	/* PSG register 14 is the keyboard line set in PPI port C */
+	if ((ppi_c >> 6) == 1 && psg_sel == 14) {
+	    return space && (ppi_c & 0x0f) == 5 ? 0x7f : 0xff;
+	}
+	return 0xff;
+    case 1:
+	return 0x5e | (t < VSYNC_T);
+    }
+    return 0xff;
+}
+
+static void port_out(word port, byte data) {
+    t += 4;
+    if ((port >> 8) == 0xff) zone_mark(data);
+    if (port & 0x0800) return;
+    switch ((port >> 8) & 3) {
+    case 0:
+	ppi_a = data;
+	break;
+    case 2:
+	ppi_c = data;
+	if ((data >> 6) == 3) psg_sel = ppi_a & 0x0f;
+	break;
+    }
+}
+#endif
+
+static void init_flags(void) {
+    for (int i = 0; i < 256; i++) {
+	byte parity = i;
+	parity ^= parity >> 4;
+	parity ^= parity >> 2;
+	parity ^= parity >> 1;
+	sz53[i] = (i & (FS | FY | FX)) | (i ? 0 : FZ);
+	sz53p[i] = sz53[i] | (parity & 1 ? 0 : FV);
+    }
+}
+
+static word get_pair(byte i) {
+    return (reg[i] << 8) | reg[i + 1];
+}
+
+static void set_pair(byte i, word data) {
+    reg[i] = data >> 8;
+    reg[i + 1] = data;
+}
+
+/* rp of the opcode tables: BC DE HL SP, HL being IX or IY after a prefix */
+static word get_rp(byte p, byte idx) {
+    if (p == 3) return sp;
+    if (p == 2 && idx) {
+	return (index_reg[idx - 1][0] << 8) | index_reg[idx - 1][1];
+    }
+    return get_pair(p << 1);
+}
+
+static void set_rp(byte p, byte idx, word data) {
+    if (p == 3) {
+	sp = data;
+    }
+    else if (p == 2 && idx) {
+	index_reg[idx - 1][0] = data >> 8;
+	index_reg[idx - 1][1] = data;
+    }
+    else {
+	set_pair(p << 1, data);
+    }
+}
+
+/* rp2 of PUSH and POP has AF in place of SP */
+static word get_rp2(byte p, byte idx) {
+    return p == 3 ? (A << 8) | F : get_rp(p, idx);
+}
+
+static void set_rp2(byte p, byte idx, word data) {
+    if (p == 3) {
+	A = data >> 8;
+	F = data;
+    }
+    else {
+	set_rp(p, idx, data);
+    }
+}
+
+static byte *r8(byte i, byte idx) {
+    if (idx && (i == R_H || i == R_L)) return &index_reg[idx - 1][i - R_H];
+    return reg + i;
+}
+
+static byte cond(byte y) {
+    static const byte flag[4] = { FZ, FC, FV, FS };
+    return ((F & flag[y >> 1]) != 0) == (y & 1);
+}
+
+static void alu(byte op, byte data) {
+    byte carry = F & FC;
+    unsigned res;
+    switch (op) {
+    case 0:
+    case 1:
+	if (op == 0) carry = 0;
+	res = A + data + carry;
+	F = sz53[res & 0xff] | ((res >> 8) & FC) | ((A ^ data ^ res) & FH)
+	    | ((~(A ^ data) & (A ^ res) & 0x80) ? FV : 0);
+	A = res;
+	break;
+    case 2:
+    case 3:
+    case 7:
+	if (op != 3) carry = 0;
+	res = A - data - carry;
+	F = FN | sz53[res & 0xff] | ((res >> 8) & FC) | ((A ^ data ^ res) & FH)
+	    | (((A ^ data) & (A ^ res) & 0x80) ? FV : 0);
+	if (op == 7) {
+	    F = (F & ~(FX | FY)) | (data & (FX | FY));
+	}
+	else {
+	    A = res;
+	}
+	break;
+    case 4:
+	A &= data;
+	F = sz53p[A] | FH;
+	break;
+    case 5:
+	A ^= data;
+	F = sz53p[A];
+	break;
+    case 6:
+	A |= data;
+	F = sz53p[A];
+	break;
+    }
+}
+
+static byte inc8(byte data) {
+    byte res = data + 1;
+    F = (F & FC) | sz53[res] | ((data & 0x0f) == 0x0f ? FH : 0)
+	| (data == 0x7f ? FV : 0);
+    return res;
+}
+
+static byte dec8(byte data) {
+    byte res = data - 1;
+    F = (F & FC) | FN | sz53[res] | ((data & 0x0f) == 0 ? FH : 0)
+	| (data == 0x80 ? FV : 0);
+    return res;
+}
+
+static word add16(word a, word b) {
+    unsigned res = a + b;
+    F = (F & (FS | FZ | FV)) | ((res >> 16) & FC) | ((res >> 8) & (FX | FY))
+	| (((a ^ b ^ res) >> 8) & FH);
+    return res;
+}
+
+static word adc16(word a, word b) {
+    unsigned res = a + b + (F & FC);
+    F = ((res >> 16) & FC) | ((res >> 8) & (FS | FX | FY))
+	| (((a ^ b ^ res) >> 8) & FH) | ((word) res ? 0 : FZ)
+	| ((~(a ^ b) & (a ^ res) & 0x8000) ? FV : 0);
+    return res;
+}
+
+static word sbc16(word a, word b) {
+    unsigned res = a - b - (F & FC);
+    F = FN | ((res >> 16) & FC) | ((res >> 8) & (FS | FX | FY))
+	| (((a ^ b ^ res) >> 8) & FH) | ((word) res ? 0 : FZ)
+	| (((a ^ b) & (a ^ res) & 0x8000) ? FV : 0);
+    return res;
+}
+
+static void daa(void) {
+    byte add = 0, carry = F & FC, a = A;
+    if ((F & FH) || (a & 0x0f) > 9) add = 6;
+    if (carry || a > 0x99) {
+	add |= 0x60;
+	carry = FC;
+    }
+    if (F & FN) {
+	A = a - add;
+	F = FN | ((F & FH) && (a & 0x0f) < 6 ? FH : 0);
+    }
+    else {
+	A = a + add;
+	F = (a & 0x0f) > 9 ? FH : 0;
+    }
+    F |= carry | sz53p[A];
+}
+
+/* RLCA RRCA RLA RRA DAA CPL SCF CCF */
+static void acc_op(byte y) {
+    byte a = A, keep = F & (FS | FZ | FV);
+    switch (y) {
+    case 0:
+	A = (a << 1) | (a >> 7);
+	F = keep | (A & (FX | FY | FC));
+	break;
+    case 1:
+	A = (a >> 1) | (a << 7);
+	F = keep | (A & (FX | FY)) | (a & FC);
+	break;
+    case 2:
+	A = (a << 1) | (F & FC);
+	F = keep | (A & (FX | FY)) | (a >> 7);
+	break;
+    case 3:
+	A = (a >> 1) | (F << 7);
+	F = keep | (A & (FX | FY)) | (a & FC);
+	break;
+    case 4:
+	daa();
+	break;
+    case 5:
+	A = ~a;
+	F = (F & (FS | FZ | FV | FC)) | FH | FN | (A & (FX | FY));
+	break;
+    case 6:
+	F = keep | FC | (a & (FX | FY));
+	break;
+    case 7:
+	F = keep | (F & FC ? FH : FC) | (a & (FX | FY));
+	break;
+    }
+}
+
+/* RLC RRC RL RR SLA SRA SLL SRL */
+static byte rot(byte y, byte data) {
+    byte carry, res;
+    switch (y) {
+    case 0:
+	carry = data >> 7;
+	res = (data << 1) | carry;
+	break;
+    case 1:
+	carry = data & 1;
+	res = (data >> 1) | (carry << 7);
+	break;
+    case 2:
+	carry = data >> 7;
+	res = (data << 1) | (F & FC);
+	break;
+    case 3:
+	carry = data & 1;
+	res = (data >> 1) | (F << 7);
+	break;
+    case 4:
+	carry = data >> 7;
+	res = data << 1;
+	break;
+    case 5:
+	carry = data & 1;
+	res = (data & 0x80) | (data >> 1);
+	break;
+    case 6:
+	carry = data >> 7;
+	res = (data << 1) | 1;
+	break;
+    default:
+	carry = data & 1;
+	res = data >> 1;
+	break;
+    }
+    F = sz53p[res] | carry;
+    return res;
+}
+
+static byte cb_op(byte op, byte data) {
+    byte y = (op >> 3) & 7;
+    switch (op >> 6) {
+    case 0:
+	return rot(y, data);
+    case 1:
+	F = (F & FC) | FH | (data & (FX | FY));
+	if ((data & (1 << y)) == 0) F |= FZ | FV;
+	if (y == 7 && (data & 0x80)) F |= FS;
+	return data;
+    case 2:
+	return data & ~(1 << y);
+    default:
+	return data | (1 << y);
+    }
+}
+
+static void bit_op(void) {
+    byte op = fetch();
+    byte z = op & 7;
+    if (z != 6) {
+	reg[z] = cb_op(op, reg[z]);
+	return;
+    }
+    word hl = get_pair(R_H);
+    byte data = read8(hl);
+    idle(hl, 1);
+    byte res = cb_op(op, data);
+    if ((op >> 6) != 1) write8(hl, res);
+}
+
+/* DDCB and FDCB, the displacement comes before the opcode */
+static void index_cb(byte idx) {
+    int8 d = read8(pc++);
+    byte op = read8(pc);
+    idle(pc++, 2);
+    word addr = get_rp(2, idx) + d;
+    byte data = read8(addr);
+    idle(addr, 1);
+    byte res = cb_op(op, data);
+    if ((op >> 6) == 1) return;
+    write8(addr, res);
+    if ((op & 7) != 6) reg[op & 7] = res;
+}
+
+static void enter(byte isr, unsigned long long start);
+static void leave(word at);
+
+static void call(word addr) {
+    idle(pc - 1, 1);
+    push16(pc);
+    pc = addr;
+    enter(0, NOW);
+}
+
+static void ret(void) {
+    word at = sp;
+    pc = pop16();
+    leave(at);
+}
+
+/* LDI CPI INI OUTI and their decrementing and repeating forms */
+static void block(byte y, byte z) {
+    int8 dir = y & 1 ? -1 : 1;
+    byte repeat = y >= 6;
+    word hl = get_pair(R_H);
+    word de = get_pair(R_D);
+    word bc = get_pair(R_B);
+    byte data, res, n;
+    switch (z) {
+    case 0:
+	data = read8(hl);
+	write8(de, data);
+	idle(de, 2);
+	set_pair(R_B, --bc);
+	n = data + A;
+	F = (F & (FS | FZ | FC)) | (bc ? FV : 0) | (n & FX) | (n & 2 ? FY : 0);
+	if (repeat && bc) {
+	    idle(de, 5);
+	    pc -= 2;
+	}
+	set_pair(R_H, hl + dir);
+	set_pair(R_D, de + dir);
+	break;
+    case 1:
+	data = read8(hl);
+	idle(hl, 5);
+	res = A - data;
+	set_pair(R_B, --bc);
+	F = (F & FC) | FN | (res & FS) | (res ? 0 : FZ) | (bc ? FV : 0)
+	    | ((A ^ data ^ res) & FH);
+	n = res - (F & FH ? 1 : 0);
+	F |= (n & FX) | (n & 2 ? FY : 0);
+	if (repeat && bc && res) {
+	    idle(hl, 5);
+	    pc -= 2;
+	}
+	set_pair(R_H, hl + dir);
+	break;
+    case 2:
+	/* only S, Z and N of the block I/O flags */
+	idle(ir(), 1);
+	data = port_in(bc);
+	write8(hl, data);
+	F = sz53[--reg[R_B]] | FN;
+	if (repeat && reg[R_B]) {
+	    idle(hl, 5);
+	    pc -= 2;
+	}
+	set_pair(R_H, hl + dir);
+	break;
+    case 3:
+	idle(ir(), 1);
+	data = read8(hl);
+	F = sz53[--reg[R_B]] | FN;
+	port_out(get_pair(R_B), data);
+	if (repeat && reg[R_B]) {
+	    idle(get_pair(R_B), 5);
+	    pc -= 2;
+	}
+	set_pair(R_H, hl + dir);
+	break;
+    }
+}
+
+static void extended(void) {
+    byte op = fetch();
+    byte x = op >> 6, y = (op >> 3) & 7, z = op & 7, p = y >> 1, q = y & 1;
+    word hl = get_pair(R_H);
+    word addr, data16;
+    byte data;
+    if (x == 2 && y >= 4 && z <= 3) {
+	block(y, z);
+	return;
+    }
+    if (x != 1) return;
+    switch (z) {
+    case 0:
+	data = port_in(get_pair(R_B));
+	F = (F & FC) | sz53p[data];
+	if (y != 6) reg[y] = data;
+	break;
+    case 1:
+	port_out(get_pair(R_B), y == 6 ? 0 : reg[y]);
+	break;
+    case 2:
+	idle(ir(), 7);
+	data16 = get_rp(p, 0);
+	set_pair(R_H, q ? adc16(hl, data16) : sbc16(hl, data16));
+	break;
+    case 3:
+	addr = arg16();
+	if (q) {
+	    data = read8(addr);
+	    set_rp(p, 0, data | (read8(addr + 1) << 8));
+	}
+	else {
+	    data16 = get_rp(p, 0);
+	    write8(addr, data16);
+	    write8(addr + 1, data16 >> 8);
+	}
+	break;
+    case 4:
+	data = A;
+	A = 0;
+	alu(2, data);
+	break;
+    case 5:
+	iff1 = iff2;
+	ret();
+	break;
+    case 6:
+	im = (y & 3) < 2 ? 0 : (y & 3) - 1;
+	break;
+    case 7:
+	switch (y) {
+	case 0:
+	    idle(ir(), 1);
+	    ir_i = A;
+	    break;
+	case 1:
+	    idle(ir(), 1);
+	    ir_r = A;
+	    break;
+	case 2:
+	case 3:
+	    idle(ir(), 1);
+	    A = y == 2 ? ir_i : ir_r;
+	    F = (F & FC) | sz53[A] | (iff2 ? FV : 0);
+	    break;
+	case 4:
+	case 5:
+	    data = read8(hl);
+	    idle(hl, 4);
+	    if (y == 4) {
+		write8(hl, (A << 4) | (data >> 4));
+		A = (A & 0xf0) | (data & 0x0f);
+	    }
+	    else {
+		write8(hl, (data << 4) | (A & 0x0f));
+		A = (A & 0xf0) | (data >> 4);
+	    }
+	    F = (F & FC) | sz53p[A];
+	    break;
+	}
+	break;
+    }
+}
+
+/* (HL), or (IX+d) and (IY+d) with their displacement */
+static word index_addr(byte idx) {
+    word base = get_rp(2, idx);
+    if (idx == 0) return base;
+    word at = pc;
+    int8 d = read8(pc++);
+    idle(at, 5);
+    return base + d;
+}
+
+static void swap(byte *a, byte *b) {
+    byte tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+static void base_op(byte op, byte idx) {
+    byte x = op >> 6, y = (op >> 3) & 7, z = op & 7, p = y >> 1, q = y & 1;
+    word hl = get_rp(2, idx);
+    word addr;
+    byte data;
+    int8 d;
+    switch (x) {
+    case 0:
+	switch (z) {
+	case 0:
+	    if (y == 1) {
+		swap(reg + R_F, alt + R_F);
+		swap(reg + R_A, alt + R_A);
+	    }
+	    else if (y >= 2) {
+		if (y == 2) idle(ir(), 1);
+		addr = pc;
+		d = read8(pc++);
+		if (y == 2 ? --reg[R_B] != 0 : y == 3 || cond(y - 4)) {
+		    idle(addr, 5);
+		    pc += d;
+		}
+	    }
+	    break;
+	case 1:
+	    if (q == 0) {
+		set_rp(p, idx, arg16());
+	    }
+	    else {
+		idle(ir(), 7);
+		set_rp(2, idx, add16(hl, get_rp(p, idx)));
+	    }
+	    break;
+	case 2:
+	    switch (y) {
+	    case 0:
+		write8(get_pair(R_B), A);
+		break;
+	    case 1:
+		A = read8(get_pair(R_B));
+		break;
+	    case 2:
+		write8(get_pair(R_D), A);
+		break;
+	    case 3:
+		A = read8(get_pair(R_D));
+		break;
+	    case 4:
+		addr = arg16();
+		write8(addr, hl);
+		write8(addr + 1, hl >> 8);
+		break;
+	    case 5:
+		addr = arg16();
+		data = read8(addr);
+		set_rp(2, idx, data | (read8(addr + 1) << 8));
+		break;
+	    case 6:
+		write8(arg16(), A);
+		break;
+	    case 7:
+		A = read8(arg16());
+		break;
+	    }
+	    break;
+	case 3:
+	    idle(ir(), 2);
+	    set_rp(p, idx, get_rp(p, idx) + (q ? -1 : 1));
+	    break;
+	case 4:
+	case 5:
+	    if (y == 6) {
+		addr = index_addr(idx);
+		data = read8(addr);
+		idle(addr, 1);
+		write8(addr, z == 4 ? inc8(data) : dec8(data));
+	    }
+	    else {
+		byte *r = r8(y, idx);
+		*r = z == 4 ? inc8(*r) : dec8(*r);
+	    }
+	    break;
+	case 6:
+	    if (y == 6 && idx) {
+		d = read8(pc++);
+		data = read8(pc);
+		idle(pc++, 2);
+		write8(hl + d, data);
+	    }
+	    else if (y == 6) {
+		data = arg8();
+		write8(hl, data);
+	    }
+	    else {
+		*r8(y, idx) = arg8();
+	    }
+	    break;
+	case 7:
+	    acc_op(y);
+	    break;
+	}
+	break;
+    case 1:
+	if (op == 0x76) {
+	    halted = 1;
+	}
+	else if (z == 6) {
+	    addr = index_addr(idx);
+	    reg[y] = read8(addr);
+	}
+	else if (y == 6) {
+	    addr = index_addr(idx);
+	    write8(addr, reg[z]);
+	}
+	else {
+	    *r8(y, idx) = *r8(z, idx);
+	}
+	break;
+    case 2:
+	alu(y, z == 6 ? read8(index_addr(idx)) : *r8(z, idx));
+	break;
+    case 3:
+	switch (z) {
+	case 0:
+	    idle(ir(), 1);
+	    if (cond(y)) ret();
+	    break;
+	case 1:
+	    if (q == 0) {
+		set_rp2(p, idx, pop16());
+	    }
+	    else if (p == 0) {
+		ret();
+	    }
+	    else if (p == 1) {
+		for (byte i = R_B; i <= R_L; i++) swap(reg + i, alt + i);
+	    }
+	    else if (p == 2) {
+		pc = hl;
+	    }
+	    else {
+		idle(ir(), 2);
+		sp = hl;
+	    }
+	    break;
+	case 2:
+	    addr = arg16();
+	    if (cond(y)) pc = addr;
+	    break;
+	case 3:
+	    switch (y) {
+	    case 0:
+		pc = arg16();
+		break;
+	    case 2:
+		data = arg8();
+		port_out((A << 8) | data, A);
+		break;
+	    case 3:
+		data = arg8();
+		A = port_in((A << 8) | data);
+		break;
+	    case 4: {
+		byte lo = read8(sp), hi = read8(sp + 1);
+		idle(sp + 1, 1);
+		write8(sp + 1, hl >> 8);
+		write8(sp, hl);
+		idle(sp, 2);
+		set_rp(2, idx, lo | (hi << 8));
+		break;
+	    }
+	    case 5:
+		swap(reg + R_D, reg + R_H);
+		swap(reg + R_E, reg + R_L);
+		break;
+	    case 6:
+		iff1 = iff2 = 0;
+		break;
+	    case 7:
+		iff1 = iff2 = 1;
+		ei_just = 1;
+		break;
+	    }
+	    break;
+	case 4:
+	    addr = arg16();
+	    if (cond(y)) call(addr);
+	    break;
+	case 5:
+	    if (q == 0) {
+		idle(ir(), 1);
+		push16(get_rp2(p, idx));
+	    }
+	    else {
+		call(arg16());
+	    }
+	    break;
+	case 6:
+	    alu(y, arg8());
+	    break;
+	case 7:
+	    idle(ir(), 1);
+	    push16(pc);
+	    pc = y << 3;
+	    enter(0, NOW);
+	    break;
+	}
+	break;
+    }
+}
+
+static void step(void) {
+    byte idx = 0;
+    ei_just = 0;
+    if (halted) {
+	t += 4;
+	ir_r = (ir_r & 0x80) | ((ir_r + 1) & 0x7f);
+	return;
+    }
+    byte op = fetch();
+    while (op == 0xdd || op == 0xfd) {
+	idx = op == 0xdd ? 1 : 2;
+	op = fetch();
+    }
+    if (op == 0xcb) {
+	if (idx) index_cb(idx); else bit_op();
+    }
+    else if (op == 0xed) {
+	extended();
+    }
+    else {
+	base_op(op, idx);
+    }
+#if defined(CPC)
+    t = (t + 3) & ~3;
+#endif
+}
+
+/* the game runs in IM 2 with a full table, the bus reads 0xff */
+static void interrupt(void) {
+    unsigned long long start = NOW;
+    halted = 0;
+    iff1 = iff2 = 0;
+    ir_r = (ir_r & 0x80) | ((ir_r + 1) & 0x7f);
+    t += 7;
+    push16(pc);
+    if (im == 2) {
+	word vector = (ir_i << 8) | 0xff;
+	byte lo = read8(vector);
+	pc = lo | (read8(vector + 1) << 8);
+    }
+    else {
+	pc = 0x38;
+    }
+    enter(1, start);
+#if defined(CPC)
+    t = (t + 3) & ~3;
+#endif
+}
+
+struct Symbol {
+    word addr;
+    word end;		/* of a function, when moonrn.cdb has it */
+    char name[40];
+};
+
+#define SYMBOLS		4096
+
+static struct Symbol sym[SYMBOLS];
+static int syms;
+static int level_count;
+
+static void add_symbol(const char *name, unsigned addr, byte end) {
+    int i = 0;
+    while (i < syms && strcmp(sym[i].name, name) != 0) i++;
+    if (i == syms) {
+	if (end || syms == SYMBOLS) return;
+	snprintf(sym[i].name, sizeof(sym[i].name), "%s", name);
+	sym[i].addr = addr;
+	syms++;
+    }
+    if (end) sym[i].end = addr;
+}
+
+/* globals of the linker map, "00008800  _start_up  main" */
+static void load_map(const char *name) {
+    FILE *file = fopen(name, "r");
+    char line[256], id[64];
+    unsigned addr;
+    if (file == NULL) return;
+    while (fgets(line, sizeof(line), file)) {
+	if (sscanf(line, " %x %63s", &addr, id) == 2 && id[0] == '_') {
+	    add_symbol(id + 1, addr, 0);
+	}
+    }
+    fclose(file);
+}
+
+/*
+ * "L:G$name$0_0$0:8800" for globals, "L:Fmain$name$0_0$0:8A00" for statics,
+ * an X after the L: gives the end of a function
+ */
+static void load_cdb(const char *name) {
+    FILE *file = fopen(name, "r");
+    char line[1024];
+    if (file == NULL) return;
+    while (fgets(line, sizeof(line), file)) {
+	if (strncmp(line, "S:", 2) == 0 && strstr(line, "$level_list$")) {
+	    char *dim = strstr(line, "({");
+	    dim = dim ? strstr(dim, "DA") : NULL;
+	    if (dim) level_count = atoi(dim + 2);
+	    continue;
+	}
+	if (strncmp(line, "L:", 2) != 0) continue;
+	byte end = line[2] == 'X';
+	const char *scope = line + 2 + end;
+	if (strncmp(scope, "G$", 2) && *scope != 'F') continue;
+	char *colon = strrchr(line, ':');
+	char *id = strchr(line, '$');
+	char *stop = id ? strchr(id + 1, '$') : NULL;
+	if (stop == NULL || colon < stop) continue;
+	*stop = 0;
+	add_symbol(id + 1, strtoul(colon + 1, NULL, 16), end);
+    }
+    fclose(file);
+}
+
+static word symbol(const char *name) {
+    for (int i = 0; i < syms; i++) {
+	if (strcmp(sym[i].name, name) == 0) return sym[i].addr;
+    }
+    fprintf(stderr, "%s is not in moonrn.map or moonrn.cdb,"
+	    " build with DEBUG=--debug\n", name);
+    exit(1);
+}
+
+static int by_addr(const void *a, const void *b) {
+    word x = ((const struct Symbol *) a)->addr;
+    word y = ((const struct Symbol *) b)->addr;
+    return (x > y) - (x < y);
+}
+
+/* the symbol at or below addr, -1 past the end of a function */
+static int symbol_at(word addr) {
+    int lo = 0, hi = syms - 1;
+    if (syms == 0 || addr < sym[0].addr) return -1;
+    while (lo < hi) {
+	int mid = (lo + hi + 1) / 2;
+	if (sym[mid].addr <= addr) lo = mid; else hi = mid - 1;
+    }
+    if (sym[lo].end && addr > sym[lo].end) return -1;
+    return lo;
+}
+
+static FILE *open_file(const char *name, const char *mode) {
+    FILE *file = fopen(name, mode);
+    if (file == NULL) {
+	fprintf(stderr, "can not open %s\n", name);
+	exit(1);
+    }
+    return file;
+}
+
+static void load_ihx(const char *name) {
+    FILE *file = open_file(name, "r");
+    char line[600];
+    while (fgets(line, sizeof(line), file)) {
+	unsigned len, addr, type, data;
+	if (sscanf(line, ":%2x%4x%2x", &len, &addr, &type) != 3) continue;
+	if (type != 0) continue;
+	for (unsigned i = 0; i < len; i++) {
+	    if (sscanf(line + 9 + 2 * i, "%2x", &data) != 1) break;
+	    mem[(addr + i) & 0xffff] = data;
+	}
+    }
+    fclose(file);
+}
+
+#if defined(ZXS)
+static void load_font(const char *name) {
+    FILE *file = open_file(name, "rb");
+    if (fread(mem + 0x3d00, 1, 0x300, file) != 0x300) {
+	fprintf(stderr, "%s is short\n", name);
+	exit(1);
+    }
+    fclose(file);
+}
+#endif
+
+#define SHADOW_DEPTH	64
+
+struct Frame {
+    word sp;		/* where the return address is */
+    word ret;
+    byte isr;
+    signed char fn;	/* entry of count[] that was called, -1 if none */
+    unsigned long long start;
+    unsigned long long isr_start;
+};
+
+#define COUNTS		16
+
+struct Count {
+    const char *name;
+    word addr;
+    long calls;
+    unsigned long long total;
+    unsigned max;
+};
+
+static struct Frame shadow[SHADOW_DEPTH];
+static int depth;
+static struct Count count[COUNTS];
+static int counts;
+static unsigned long long isr_time;
+static long isr_calls;
+static unsigned long long isr_total;
+static unsigned isr_max;
+
+/* drop the frames whose return address is below top */
+static void unwind(word top) {
+    while (depth > 0 && shadow[depth - 1].sp < top) depth--;
+}
+
+static void enter(byte isr, unsigned long long start) {
+    unwind(sp + 1);
+    if (depth == SHADOW_DEPTH) return;
+    shadow[depth].sp = sp;
+    shadow[depth].ret = mem[sp] | (mem[(word) (sp + 1)] << 8);
+    shadow[depth].isr = isr;
+    shadow[depth].fn = -1;
+    shadow[depth].start = start;
+    shadow[depth].isr_start = isr_time;
+    depth++;
+}
+
+/* RET with the return address at, only that frame has run to its end */
+static void leave(word at) {
+    unwind(at);
+    if (depth == 0 || shadow[depth - 1].sp != at) return;
+    struct Frame *frame = shadow + --depth;
+    unsigned long long spent = NOW - frame->start;
+    if (frame->isr) {
+	isr_time += spent;
+	isr_calls++;
+	isr_total += spent;
+	if (spent > isr_max) isr_max = spent;
+    }
+    else if (frame->fn >= 0) {
+	struct Count *c = count + frame->fn;
+	spent -= isr_time - frame->isr_start;
+	c->calls++;
+	c->total += spent;
+	if (spent > c->max) c->max = spent;
+    }
+}
+
+/* a -c function starts, a jp to it takes over the frame of its caller */
+static void count_entry(void) {
+    struct Frame *frame = shadow + depth - 1;
+    if (depth == 0 || frame->isr) return;
+    for (int i = 0; i < counts; i++) {
+	if (pc == count[i].addr) {
+	    frame->fn = i;
+	    frame->start = NOW;
+	    frame->isr_start = isr_time;
+	}
+    }
+}
+
+static void count_report(void) {
+    printf("T-states a call, callees included, interrupts left out\n");
+    printf("function          calls    mean     max       total\n");
+    for (int i = 0; i < counts; i++) {
+	struct Count *c = count + i;
+	printf("%-14s %8ld %7.0f %7u %11llu\n", c->name, c->calls,
+	       c->calls ? (double) c->total / c->calls : 0, c->max, c->total);
+    }
+}
+
+#define PROF_DEPTH	32
+#define PROF_STACKS	4096
+
+struct Stack {
+    short fn[PROF_DEPTH];
+    int depth;
+    byte isr;
+    long count;
+};
+
+static FILE *folded;
+static struct Stack *prof;
+static long prof_lost;
+static long interval = 1000;
+static unsigned long long next_sample;
+
+static void sample(void) {
+    short fn[PROF_DEPTH];
+    int from = 0, n = 0;
+    byte isr = 0;
+    next_sample += interval;
+    unwind(sp);
+    for (int i = depth - 1; i >= 0; i--) {
+	if (shadow[i].isr) {
+	    from = i + 1;
+	    isr = 1;
+	    break;
+	}
+    }
+    for (int i = from; i < depth && n < PROF_DEPTH - 1; i++) {
+	fn[n++] = symbol_at(shadow[i].ret - 1);
+    }
+    fn[n++] = symbol_at(pc);
+
+    unsigned hash = n * 2 + isr;
+    for (int i = 0; i < n; i++) hash = hash * 31 + fn[i];
+    for (int k = 0; k < PROF_STACKS; k++) {
+	struct Stack *stack = prof + (hash + k) % PROF_STACKS;
+	if (stack->count == 0) {
+	    memcpy(stack->fn, fn, n * sizeof(*fn));
+	    stack->depth = n;
+	    stack->isr = isr;
+	}
+	else if (stack->depth != n || stack->isr != isr ||
+		 memcmp(stack->fn, fn, n * sizeof(*fn))) {
+	    continue;
+	}
+	stack->count++;
+	return;
+    }
+    prof_lost++;
+}
+
+struct Folded {
+    char path[PROF_DEPTH * 40];
+    long count;
+};
+
+static int by_path(const void *a, const void *b) {
+    return strcmp(((const struct Folded *) a)->path,
+		  ((const struct Folded *) b)->path);
+}
+
+static void prof_write(void) {
+    struct Folded *line = calloc(PROF_STACKS, sizeof(*line));
+    long total[2] = { 0, 0 };
+    int lines = 0;
+    for (int k = 0; k < PROF_STACKS; k++) {
+	struct Stack *stack = prof + k;
+	if (stack->count == 0) continue;
+	char *path = line[lines].path;
+	strcpy(path, stack->isr ? "interrupt" : "main");
+	for (int i = 0; i < stack->depth; i++) {
+	    strcat(path, ";");
+	    strcat(path, stack->fn[i] < 0 ? "?" : sym[stack->fn[i]].name);
+	}
+	line[lines++].count = stack->count;
+	total[stack->isr] += stack->count;
+    }
+    qsort(line, lines, sizeof(*line), by_path);
+    for (int n = 0; n < lines; n++) {
+	fprintf(folded, "%s %ld\n", line[n].path, line[n].count);
+    }
+    fclose(folded);
+    free(line);
+    fprintf(stderr, "%ld main, %ld interrupt, %ld lost samples\n",
+	    total[0], total[1], prof_lost);
+}
+
+/* frames before top_level that are given up on */
+#define BOOT_FRAMES	20000
+
+static long limit = 3000;
+static long period = 24;
+static FILE *replay;
+static const char *replay_name;
+static byte run;
+static int first = 1;
+static byte one_level;
+static long frames;
+static long played;
+static byte playing;
+
+static word top_level;
+static word wait_vblank;
+static word level;
+static word run_num;
+static long waited = -1;	/* T-states into the frame of wait_vblank */
+
+/* -y writes AYREGS each time Player_Decode returns to its caller */
+static FILE *ay_frames;
+static word decode;
+static word decode_ret;
+static word decode_sp;
+static word ayregs;
+static long decoded;
+
+static unsigned *cost;
+static long costs;
+static long over;
+
+/* the frames of every level of a -p log */
+static unsigned *level_cost[256];
+static long level_costs[256];
+static long level_over[256];
+
+static int by_cost(const void *a, const void *b) {
+    unsigned x = * (const unsigned *) a;
+    unsigned y = * (const unsigned *) b;
+    return (x > y) - (x < y);
+}
+
+static void bench_report(int level, unsigned *cost, long costs, long over) {
+    double sum = 0;
+    if (costs == 0) return;
+    qsort(cost, costs, sizeof(*cost), by_cost);
+    for (long i = 0; i < costs; i++) sum += cost[i];
+    printf("%5d %7ld %7.0f %7u %7u %7ld\n", level, costs, sum / costs,
+	   cost[costs * 99 / 100], cost[costs - 1], over);
+}
+
+static void level_sample(byte level, unsigned spent) {
+    long n = level_costs[level]++;
+    if ((n & (n - 1)) == 0) {
+	level_cost[level] = realloc(level_cost[level],
+				    2 * (n + 1) * sizeof(unsigned));
+    }
+    level_cost[level][n] = spent;
+    if (spent >= frame_t) level_over[level]++;
+}
+
+static void replay_report(void) {
+    printf("%s\n", replay_name);
+    printf("level  frames    mean     p99     max    over\n");
+    for (int i = 0; i < 256; i++) {
+	bench_report(i, level_cost[i], level_costs[i], level_over[i]);
+    }
+}
+
+static void isr_report(void) {
+    printf("interrupts: %ld, %.0f T mean, %u T max\n", isr_calls,
+	   isr_calls ? (double) isr_total / isr_calls : 0, isr_max);
+}
+
+#if defined(ZXS)
+static void ula_report(void) {
+    printf("ULA waits a frame: %.1f T at the screen, %.1f T at 0x5b00-0x7fff\n",
+	   (double) ula_screen / frames, (double) ula_ram / frames);
+}
+#endif
+
+static void finish(void) {
+    if (folded) prof_write();
+    if (counts) count_report();
+    if (replay) replay_report();
+    else if (!folded && !counts) bench_report(first, cost, costs, over);
+    isr_report();
+#if defined(ZXS)
+    ula_report();
+#endif
+    if (zone_seen) zone_report(0, 2);
+    if (ay_frames) {
+	printf("Player_Decode returned %ld times\n", decoded);
+	fclose(ay_frames);
+    }
+    fflush(stdout);
+    exit(0);
+}
+
+static void frame_sample(void) {
+    unsigned spent = waited >= 0 ? waited : frame_t;
+    if (replay) {
+	level_sample(mem[level], spent);
+    }
+    else if (mem[level] == first && costs < limit) {
+	cost[costs++] = spent;
+	if (spent >= frame_t) over++;
+    }
+    waited = -1;
+}
+
+static void next_frame(void) {
+    if (playing) frame_sample();
+    t -= frame_t;
+    past += frame_t;
+    frames++;
+#if defined(ZXS)
+    int_taken = 0;
+#elif defined(CPC)
+    irq_next = 0;
+#endif
+    if (!replay) space = period > 0 && frames % period < 2;
+    if (playing && ++played >= limit) finish();
+    if (!playing && frames > BOOT_FRAMES) {
+	fprintf(stderr, "top_level not reached in %d frames\n", BOOT_FRAMES);
+	exit(1);
+    }
+}
+
+/* the breakpoints on the game, checked before every instruction */
+static void watch(void) {
+    if (pc == top_level && !playing) {
+	mem[level] = first;
+	mem[run_num] = run;
+	next_sample = NOW + interval;
+	isr_calls = 0;
+	isr_total = 0;
+	isr_max = 0;
+	playing = 1;
+    }
+    else if (pc == wait_vblank) {
+	if (replay) {
+	    int c = fgetc(replay);
+	    if (c == EOF) finish();
+	    space = c;
+	}
+	if (waited < 0) waited = t;
+    }
+    if (ay_frames && pc == decode) {
+	decode_ret = mem[sp] | (mem[(word) (sp + 1)] << 8);
+	decode_sp = sp + 2;
+    }
+    else if (ay_frames && pc == decode_ret && sp == decode_sp) {
+	fwrite(mem + ayregs, 1, 14, ay_frames);
+	decode_ret = 0;
+	decoded++;
+    }
+}
+
+static void run_machine(void) {
+    for (;;) {
+	if (t >= frame_t) next_frame();
+#if defined(ZXS)
+	/* the ULA holds INT low for the first int_t T-states of a frame */
+	if (t < int_t && iff1 && !ei_just && !int_taken) {
+	    int_taken = 1;
+	    interrupt();
+	}
+#elif defined(CPC)
+	if (irq_next < frame_t / IRQ_T && t >= irq_next * IRQ_T) {
+	    irq_pending = 1;
+	    irq_next++;
+	}
+	if (irq_pending && iff1 && !ei_just) {
+	    irq_pending = 0;
+	    interrupt();
+	}
+#endif
+	watch();
+	step();
+	if (folded && playing && NOW >= next_sample) sample();
+	if (counts && playing) count_entry();
+    }
+}
+
+static void bench_levels(void) {
+    int count = one_level ? first + 1 : level_count;
+    if (count == 0) {
+	fprintf(stderr, "size of level_list not in moonrn.cdb, use -l\n");
+	exit(1);
+    }
+    printf("T-states from the interrupt to wait_vblank, %ld a frame\n",
+	   frame_t);
+    printf("level  frames    mean     p99     max    over\n");
+    for (; first < count; first++) {
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid == 0) run_machine();
+	waitpid(pid, NULL, 0);
+    }
+}
+
+int main(int argc, char **argv) {
+    const char *image = "moonrn.ihx";
+    int opt;
+    while ((opt = getopt(argc, argv, "4f:j:n:l:s:i:c:p:y:")) != -1) {
+	switch (opt) {
+	case '4':
+#if defined(ZXS)
+	    frame_t = 69888;
+	    contended_t = 14335;
+	    line_t = 224;
+	    int_t = 32;
+	    has_ay = 0;
+#endif
+	    break;
+	case 'f':
+	    limit = atol(optarg);
+	    break;
+	case 'j':
+	    period = atol(optarg);
+	    break;
+	case 'n':
+	    run = atoi(optarg);
+	    break;
+	case 'l':
+	    first = atoi(optarg);
+	    one_level = 1;
+	    break;
+	case 's':
+	    folded = open_file(optarg, "w");
+	    break;
+	case 'i':
+	    interval = atol(optarg);
+	    break;
+	case 'c':
+	    for (char *name = strtok(optarg, ","); name && counts < COUNTS;
+		 name = strtok(NULL, ",")) {
+		count[counts++].name = name;
+	    }
+	    break;
+	case 'p':
+	    replay = open_file(optarg, "rb");
+	    replay_name = optarg;
+	    break;
+	case 'y':
+	    ay_frames = open_file(optarg, "wb");
+	    break;
+	default:
+	    return 1;
+	}
+    }
+    if (optind < argc) image = argv[optind];
+    if (replay) {
+	run = fgetc(replay);
+	first = fgetc(replay);
+	limit = LONG_MAX;
+    }
+    init_flags();
+    load_ihx(image);
+#if defined(ZXS)
+    load_font("font.rom");
+#endif
+    load_map("moonrn.map");
+    load_cdb("moonrn.cdb");
+    pc = symbol("start_up");
+    top_level = symbol("top_level");
+    wait_vblank = symbol("wait_vblank");
+    level = symbol("level");
+    run_num = symbol("run_num");
+    for (int i = 0; i < counts; i++) count[i].addr = symbol(count[i].name);
+    if (ay_frames) {
+	decode = symbol("Player_Decode");
+	ayregs = symbol("AYREGS");
+    }
+    qsort(sym, syms, sizeof(*sym), by_addr);
+    if (!replay) cost = malloc(limit * sizeof(*cost));
+    if (folded) prof = calloc(PROF_STACKS, sizeof(*prof));
+    if (folded || counts || replay || ay_frames) run_machine();
+    bench_levels();
+    return 0;
+}